@@ -25,9 +25,15 @@ along with broom.  If not, see <https://www.gnu.org/licenses/>.
 #include <stdexcept>
 #include <future>
 #include <string>
+#include <functional>
+#include <unordered_map>
+#include <atomic>
+#include <memory>
 
 #include "entry.hpp"
 #include "broom.hpp"
+#include "hash.hpp"
+#include "sigindex.hpp"
 
 namespace broom {
 
@@ -37,35 +43,262 @@ Broom::~Broom() {};
 // recursively track every file that lies in given path. Throws an invalid_argument
 // error in case path does not exist
 std::vector<entry::Entry> Broom::track(const std::filesystem::path path) {
-    std::vector<entry::Entry> tracked_entries;
+    checkpoint::State state = new_scan(path);
+    checkpoint::Checkpointer no_checkpoints;
 
+    track(state, no_checkpoints);
+
+    return state.entries;
+};
+
+// creates a fresh scan state for given path. Throws an invalid_argument
+// error in case path does not exist
+checkpoint::State Broom::new_scan(const std::filesystem::path path) {
     // check if given path even exists
     if (!std::filesystem::exists(path)) {
         throw std::invalid_argument("\"" + path.string() + "\"" + " does not exist !");
     }
 
+    // the scan could be resumed from another working directory, so every path it keeps has to be absolute
+    checkpoint::State state;
+    state.root = std::filesystem::weakly_canonical(path);
+
     if (std::filesystem::is_directory(path)) {
-        // it`s a directory. Track every regular file recursively
-        std::filesystem::directory_options options =  (
-        std::filesystem::directory_options::skip_permission_denied
-        );
-
-        for (auto dir_entry : std::filesystem::recursive_directory_iterator(path, options)) {
-            if (!dir_entry.is_regular_file() || std::filesystem::is_symlink(dir_entry.path())) {
-                // skip everything that we cannot process so easily
+        // it`s a directory. Walk it later
+        state.frontier.push_back(state.root);
+    } else if (std::filesystem::is_regular_file(path) && !std::filesystem::is_symlink(path)) {
+        // just a file
+        entry::Entry entry(state.root);
+        state.entries.push_back(entry);
+    }
+
+    return state;
+};
+
+// walks directories left in state's frontier, tracking every regular file on the way.
+// State is periodically saved via given checkpointer, so the walk can be continued later
+void Broom::track(checkpoint::State& state, checkpoint::Checkpointer& checkpointer) {
+    while (!state.frontier.empty()) {
+        entry::Directory directory;
+        directory.path = state.frontier.back();
+        directory.children = 0;
+        state.frontier.pop_back();
+
+        // the directory could be forbidden to us or could have been removed or renamed since it was met
+        // (ie: before resuming), which is not a reason to give up on the whole walk
+        std::error_code error;
+        std::filesystem::directory_iterator dir_iter(directory.path, error);
+        for (; !error && dir_iter != std::filesystem::directory_iterator(); dir_iter.increment(error)) {
+            const std::filesystem::directory_entry& dir_entry = *dir_iter;
+            directory.children++;
+
+            std::error_code entry_error;
+            if (dir_entry.is_symlink(entry_error) || entry_error) {
+                // do not follow symlinks
                 continue;
-            };
+            }
 
-            entry::Entry entry(dir_entry.path());
-            tracked_entries.push_back(entry);
+            if (dir_entry.is_directory(entry_error)) {
+                // walk it later
+                state.frontier.push_back(dir_entry.path());
+            } else if (dir_entry.is_regular_file(entry_error)) {
+                try {
+                    entry::Entry entry(dir_entry.path());
+                    state.entries.push_back(entry);
+                } catch(const std::filesystem::filesystem_error&) {
+                    // vanished in the middle of the walk
+                }
+            }
+            // skip everything that we cannot process so easily
         }
-    } else if (std::filesystem::is_regular_file(path) && !std::filesystem::is_symlink(path)) {
-        // just a file
-        entry::Entry entry(path);
-        tracked_entries.push_back(entry);
+
+        if (!error) {
+            // only fully walked directories are remembered, so an unreadable one is never taken for empty
+            state.directories.push_back(directory);
+        }
+
+        // only save between directories, so a half-walked directory does not get lost
+        if (checkpointer.due()) {
+            checkpointer.save(state);
+        }
+    }
+};
+
+// runs every stage that is left according to the command the state was started with and finishes
+// the scan (see finish). State is periodically saved via given checkpointer, so the scan can be continued later
+Results Broom::run(checkpoint::State& state, checkpoint::Checkpointer& checkpointer, const Options& options) {
+    while (run_stage(state, checkpointer, options.threads)) {}
+
+    return finish(state, checkpointer, options);
+};
+
+// completes the stage the state is at and moves it on to the next one, saving it via given checkpointer.
+// Returns false if every stage is already done
+bool Broom::run_stage(checkpoint::State& state, checkpoint::Checkpointer& checkpointer, const unsigned int threads) {
+    const bool indexing = state.command == checkpoint::INDEX;
+    std::vector<entry::Entry>& tracked_entries = state.entries;
+
+    switch (state.stage) {
+    case checkpoint::TRACKING: {
+        // track files in a given directory
+        track(state, checkpointer);
+        std::cout << "[INFO] Tracking " << tracked_entries.size() << " files\n";
+
+        // find empty files
+        uintmax_t empty_files = find_empty_files(tracked_entries);
+        std::cout << "[INFO] Found " << empty_files << " empty files\n";
+
+        if (!state.ignore_empty && !indexing) {
+            // sweeping removes them, so they do not keep their directories from being empty
+            discount_empty_files(state.directories, tracked_entries);
+        }
+
+        // if sweeping - remove empty files right away
+        if (state.command == checkpoint::SWEEP && !state.ignore_empty) {
+            uintmax_t removed = remove_empty_files(tracked_entries);
+            std::cout << "[INFO] Removed " << removed << " empty files\n";
+        } else {
+            // just untrack them, do not remove
+            uintmax_t untracked_empty = untrack_group(tracked_entries, entry::Group::EMPTY);
+            std::cout << "[INFO] Skipped " << untracked_empty << " empty files\n";
+        }
+
+        if (!indexing) {
+            // untrack unique sizes. When indexing they still could have duplicates on other machines
+            uintmax_t untracked = untrack_unique_sizes(tracked_entries);
+            std::cout << "[INFO] Untracked " << untracked << " files with a unique size\n";
+        }
+
+        state.stage = checkpoint::PIECES;
+        break;
+    }
+
+    case checkpoint::PIECES:
+        // get content pieces for each entry
+        get_pieces(state, checkpointer);
+
+        if (!indexing) {
+            // untrack unique contents
+            uintmax_t untracked = untrack_unique_contents(tracked_entries);
+            std::cout << "[INFO] Untracked " << untracked << " files with unique contents\n";
+        }
+
+        state.stage = checkpoint::HASHING;
+        break;
+
+    case checkpoint::HASHING:
+        // make sure that the rest are truly the same by hashing them whole
+        get_hashes(state, checkpointer, threads);
+
+        state.stage = checkpoint::FINISHED;
+        break;
+
+    case checkpoint::FINISHED:
+        return false;
+    }
+
+    state.processed = 0;
+    checkpointer.save(state);
+
+    return true;
+};
+
+// acts on the state that has gone through every stage: exports an index when indexing, otherwise groups duplicates
+// and, when sweeping, REMOVES empty directories and REPLACES duplicates with symlinks. Removes the checkpoint
+Results Broom::finish(checkpoint::State& state, checkpoint::Checkpointer& checkpointer, const Options& options) {
+    const bool sweeping = state.command == checkpoint::SWEEP;
+    std::vector<entry::Entry>& tracked_entries = state.entries;
+    Results results;
+
+    // the rest does not take long, no need to keep the progress anymore
+    checkpointer.remove();
+
+    if (state.command == checkpoint::INDEX) {
+        create_signature_index(tracked_entries, options.index_file);
+        std::cout << "[INFO] Exported " << tracked_entries.size() << " signatures into " << options.index_file << "\n";
+        return results;
+    }
+
+    // emptiness is judged by the walk alone, so directories are found the same way however the scan was resumed
+    results.empty_directories = find_empty_directories(state.directories, state.root);
+    if (sweeping && !state.ignore_empty_directories) {
+        uintmax_t removed = remove_empty_directories(results.empty_directories, options.threads);
+        std::cout << "[INFO] Removed " << removed << " empty directories\n";
+        results.empty_directories.clear();
+    } else {
+        std::cout << "[INFO] Found " << results.empty_directories.size() << " empty directories\n";
+    }
+
+    uintmax_t untracked = untrack_unique_hashes(tracked_entries);
+    std::cout << "[INFO] Untracked " << untracked << " files with unique hashes\n";
+
+    // mark entries as duplicates
+    mark_as_duplicates(tracked_entries);
+
+    std::cout << "[INFO] " << tracked_entries.size() << " files left being tracked\n";
+
+    // make duplicate groups from all this mess that tracked_entries right now are
+    results.grouped_duplicates = group_duplicates(tracked_entries);
+
+    if (options.verifying) {
+        // do not trust hashes alone
+        uintmax_t untracked_different = verify_duplicates(results.grouped_duplicates);
+        std::cout << "[INFO] Untracked " << untracked_different << " files that turned out to be different\n";
+    }
+
+    if (sweeping) {
+        // remove duplicates and create symlinks
+        std::cout << "[INFO] Removing duplicates and creating symlinks...\n";
+        remove_duplicates_make_symlinks(results.grouped_duplicates);
     }
 
-    return tracked_entries;
+    return results;
+};
+
+// runs process on every state's entry, starting from the first unprocessed one. Entries that could not be
+// processed are untracked. State is periodically saved via given checkpointer, so processing can be continued later
+static void process_entries(checkpoint::State& state, checkpoint::Checkpointer& checkpointer, const std::function<void(entry::Entry&)> process) {
+    std::vector<entry::Entry>& entries = state.entries;
+
+    // entries before state.processed are done, entries in [state.processed, i) are
+    // leftovers of failed or already moved entries
+    uintmax_t i = state.processed;
+    while (i < entries.size()) {
+        // ignore possible "permission denied"s
+        try {
+            process(entries[i]);
+            if (i != state.processed) {
+                entries[state.processed] = std::move(entries[i]);
+            }
+            state.processed++;
+        } catch(...) {}
+        i++;
+
+        if (checkpointer.due()) {
+            // get rid of leftovers, so only the meaningful entries are saved
+            entries.erase(entries.begin() + state.processed, entries.begin() + i);
+            i = state.processed;
+            checkpointer.save(state);
+        }
+    }
+
+    entries.erase(entries.begin() + state.processed, entries.end());
+};
+
+// reads content pieces of state's entries, starting from the first unprocessed one. Entries that could not
+// be read are untracked. State is periodically saved via given checkpointer, so reading can be continued later
+void Broom::get_pieces(checkpoint::State& state, checkpoint::Checkpointer& checkpointer) {
+    process_entries(state, checkpointer, [](entry::Entry& entry) {
+        entry.get_pieces();
+    });
+};
+
+// hashes whole contents of state's entries, starting from the first unprocessed one, each file with given amount of
+// threads. Entries that could not be read are untracked. State is periodically saved via given checkpointer
+void Broom::get_hashes(checkpoint::State& state, checkpoint::Checkpointer& checkpointer, const unsigned int threads) {
+    process_entries(state, checkpointer, [threads](entry::Entry& entry) {
+        entry.get_hash(threads);
+    });
 };
 
 // untracks entries with unique file sizes. Returns amount of files
@@ -142,8 +375,32 @@ uintmax_t Broom::untrack_unique_contents(std::vector<entry::Entry>& tracked_entr
     return untracked;
 };
 
-// creates a list of duplicate, empty files and puts it into a file
-void Broom::create_scan_results_list(const std::map<std::string, std::vector<entry::Entry>> grouped_duplicates, const std::filesystem::path dir, const std::string filename) {
+// untracks entries with unique whole contents hashes. Returns amount of
+// files that are no longer being tracked
+uintmax_t Broom::untrack_unique_hashes(std::vector<entry::Entry>& tracked_entries) {
+    // hash, occurrences
+    std::map<uint64_t, uintmax_t> hashes_map;
+
+    for (entry::Entry& entry : tracked_entries) {
+        hashes_map[entry.hash]++;
+    };
+
+    uintmax_t untracked = 0;
+    tracked_entries.erase(std::remove_if(tracked_entries.begin(), tracked_entries.end(), [&untracked, &hashes_map](entry::Entry& entry) -> bool {
+        if (hashes_map[entry.hash] == 1) {
+            // unique
+            untracked++;
+            return true;
+        } else {
+            return false;
+        }
+    }), tracked_entries.end());
+
+    return untracked;
+};
+
+// creates a list of duplicate, empty files and empty directories and puts it into a file
+void Broom::create_scan_results_list(const std::map<std::string, std::vector<entry::Entry>> grouped_duplicates, const std::vector<std::filesystem::path> empty_directories, const std::filesystem::path dir, const std::string filename) {
     if (!std::filesystem::exists(dir)) {
         // create it then
         bool created = std::filesystem::create_directories(dir);
@@ -175,7 +432,74 @@ void Broom::create_scan_results_list(const std::map<std::string, std::vector<ent
         outfile << std::endl << std::endl;
     }
 
+    if (!empty_directories.empty()) {
+        outfile << "[EMPTY DIRECTORIES]" << std::endl;
+        for (const std::filesystem::path& empty_directory : empty_directories) {
+            outfile << empty_directory << std::endl;
+        }
+        outfile << std::endl << std::endl;
+    }
+
+    outfile.close();
+};
+
+// exports signatures (size, pieces, hash, path) of hashed tracked entries into a sorted index file
+// that can later be merged with indexes from other machines
+void Broom::create_signature_index(const std::vector<entry::Entry>& tracked_entries, const std::filesystem::path file) {
+    std::vector<sigindex::Record> records;
+    records.reserve(tracked_entries.size());
+
+    for (const entry::Entry& entry : tracked_entries) {
+        sigindex::Record record;
+        record.size = entry.filesize;
+        record.fingerprint = hash::xxh64(entry.pieces.data(), entry.pieces.size(), 0);
+        record.hash = entry.hash;
+        record.path = std::filesystem::absolute(entry.path).string();
+        records.push_back(record);
+    }
+
+    sigindex::write(file, records, sigindex::hostname());
+};
+
+// merges signature indexes, possibly made on different machines, and puts groups of files with the same contents
+// that are found in more than one index into a file. Returns amount of found groups
+uintmax_t Broom::merge_signature_indexes(const std::vector<std::filesystem::path> indexes, const std::filesystem::path dir, const std::string filename) {
+    // name every index after the machine it was made on and its file, as one machine can export several of them
+    std::vector<std::unique_ptr<sigindex::Reader>> readers;
+    std::vector<std::string> labels;
+    for (const std::filesystem::path& index : indexes) {
+        readers.push_back(std::make_unique<sigindex::Reader>(index));
+        const std::string& host = readers.back()->host;
+        labels.push_back(host.empty() ? index.filename().string() : host + " (" + index.filename().string() + ")");
+    }
+
+    if (!std::filesystem::exists(dir)) {
+        // create it then
+        bool created = std::filesystem::create_directories(dir);
+        if (!created) {
+            throw std::runtime_error("Could not create a directory to save merge results in");
+        }
+    }
+
+    std::fstream outfile(dir / filename, std::ios::out);
+    if (!outfile.is_open()) {
+        throw std::runtime_error("Could not create a merge results file");
+    }
+
+    auto now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    outfile << ">> Broom merge results file from " << std::ctime(&now) << std::endl << std::endl << std::endl;
+
+    uintmax_t groups = sigindex::merge(readers, [&outfile, &labels](const std::vector<std::pair<size_t, sigindex::Record>>& group) {
+        outfile << "[DUPLICATE GROUP]" << std::endl;
+        for (const auto& member : group) {
+            outfile << labels[member.first] << ": " << std::quoted(member.second.path) << std::endl;
+        }
+        outfile << std::endl << std::endl;
+    });
+
     outfile.close();
+
+    return groups;
 };
 
 // finds empty files among tracked entries and gives them appropriate group
@@ -215,6 +539,112 @@ uintmax_t Broom::remove_empty_files(std::vector<entry::Entry>& tracked_entries)
     return removed;
 };
 
+// returns the amount of components in path. Deeper directories have more of them
+static size_t depth(const std::filesystem::path& path) {
+    return std::distance(path.begin(), path.end());
+};
+
+// makes directories stop counting empty files among their children, as those are going to be removed. Has to
+// be called while empty files are still among tracked entries
+void Broom::discount_empty_files(std::vector<entry::Directory>& directories, const std::vector<entry::Entry>& tracked_entries) {
+    // key: path, value: directory
+    std::unordered_map<std::string, entry::Directory*> directories_map;
+    for (entry::Directory& directory : directories) {
+        directories_map[directory.path.string()] = &directory;
+    }
+
+    for (const entry::Entry& entry : tracked_entries) {
+        if (entry.group != entry::EMPTY) {
+            continue;
+        }
+
+        auto parent = directories_map.find(entry.path.parent_path().string());
+        if (parent != directories_map.end() && parent->second->children > 0) {
+            parent->second->children--;
+        }
+    }
+};
+
+// finds directories that are empty or contain nothing but such directories, judging by what was inside
+// of them during the walk. Given root itself is never considered. Returns paths of found directories, the deepest ones first
+std::vector<std::filesystem::path> Broom::find_empty_directories(const std::vector<entry::Directory>& directories, const std::filesystem::path root) {
+    // key: path, value: amount of children that are not known to be empty
+    std::unordered_map<std::string, uintmax_t> remaining_children;
+    // depth, directory
+    std::vector<std::pair<size_t, const entry::Directory*>> ordered;
+
+    for (const entry::Directory& directory : directories) {
+        remaining_children[directory.path.string()] = directory.children;
+        ordered.push_back({depth(directory.path), &directory});
+    }
+
+    // deepest directories go first, so their parents know about them being empty in time
+    std::sort(ordered.begin(), ordered.end(), [](const auto& a, const auto& b) -> bool {
+        return a.first > b.first;
+    });
+
+    std::vector<std::filesystem::path> empty_directories;
+    for (const auto& record : ordered) {
+        const std::filesystem::path& path = record.second->path;
+        if (path == root || remaining_children[path.string()] != 0) {
+            continue;
+        }
+
+        empty_directories.push_back(path);
+
+        auto parent = remaining_children.find(path.parent_path().string());
+        if (parent != remaining_children.end() && parent->second > 0) {
+            parent->second--;
+        }
+    }
+
+    return empty_directories;
+};
+
+// REMOVES found empty directories (see find_empty_directories) bottom-up, so parents are removed after their children.
+// Directories of the same depth are removed by given amount of threads at once. Returns the amount of removed directories
+uintmax_t Broom::remove_empty_directories(const std::vector<std::filesystem::path>& empty_directories, const unsigned int threads) {
+    // key: depth, value: directories of that depth; the deepest ones first
+    std::map<size_t, std::vector<std::filesystem::path>, std::greater<size_t>> levels;
+    for (const std::filesystem::path& empty_directory : empty_directories) {
+        levels[depth(empty_directory)].push_back(empty_directory);
+    }
+
+    std::atomic<uintmax_t> removed = 0;
+    for (const auto& level : levels) {
+        const std::vector<std::filesystem::path>& paths = level.second;
+
+        // directories of the same depth can not contain each other, so they are independent
+        auto remove_some = [&paths, &removed](const size_t worker, const size_t workers) {
+            for (size_t i = worker; i < paths.size(); i += workers) {
+                std::error_code error;
+                // the directory could have been replaced since the walk; never remove anything else
+                if (!std::filesystem::is_directory(std::filesystem::symlink_status(paths[i], error))) {
+                    continue;
+                }
+
+                // only succeeds if the directory is really empty; something could have appeared in it since the walk
+                if (std::filesystem::remove(paths[i], error)) {
+                    removed++;
+                }
+            }
+        };
+
+        size_t workers = std::max<size_t>(1, std::min<size_t>(threads, paths.size()));
+        std::vector<std::future<void>> jobs;
+        for (size_t worker = 1; worker < workers; worker++) {
+            jobs.push_back(std::async(std::launch::async, remove_some, worker, workers));
+        }
+        remove_some(0, workers);
+
+        for (std::future<void>& job : jobs) {
+            job.get();
+        }
+    }
+
+    return removed;
+};
+
 // Untracks specified group in tracked entries. Returns an amount of entries untracked 
 uintmax_t Broom::untrack_group(std::vector<entry::Entry>& tracked_entries, entry::Group group) {
     uintmax_t untracked = 0;
@@ -243,18 +673,19 @@ void Broom::mark_as_duplicates(std::vector<entry::Entry>& tracked_entries) {
 };
 
 
-// searches for entries with the same pieces in tracked entries and groups them together as a duplicate group, where the key is the
-// string of pieces. REMOVES EVERYTHING FROM GIVEN TRACKED ENTRIES
+// searches for entries with the same contents hash in tracked entries and groups them together as a duplicate group, where the key is the
+// hex-encoded hash. REMOVES EVERYTHING FROM GIVEN TRACKED ENTRIES
 std::map<std::string, std::vector<entry::Entry>> Broom::group_duplicates(std::vector<entry::Entry>& tracked_entries) {
     std::map<std::string, std::vector<entry::Entry>> duplicate_groups;
 
     for (auto iter = tracked_entries.begin(); iter != tracked_entries.end(); iter++) {
-      auto map_iter = duplicate_groups.find(iter->pieces);
+      std::string key = hash::to_hex(iter->hash);
+      auto map_iter = duplicate_groups.find(key);
       if (map_iter == duplicate_groups.end()) {
-        // first time seeing these pieces
+        // first time seeing this hash
         std::vector<entry::Entry> occurences;
         occurences.push_back(*iter);
-        duplicate_groups.insert({iter->pieces, occurences});
+        duplicate_groups.insert({key, occurences});
       } else {
         // add to occurrences this entry
         duplicate_groups[map_iter->first].push_back(*iter);
@@ -267,6 +698,58 @@ std::map<std::string, std::vector<entry::Entry>> Broom::group_duplicates(std::ve
     return duplicate_groups;
 };
 
+// returns true if both files have exactly the same contents. Files that can not be read are never the same
+static bool same_contents(const std::filesystem::path& a, const std::filesystem::path& b) {
+    std::ifstream file_a(a, std::ios::binary);
+    std::ifstream file_b(b, std::ios::binary);
+    if (!file_a.is_open() || !file_b.is_open()) {
+        return false;
+    }
+
+    std::vector<char> buffer_a(1024 * 1024);
+    std::vector<char> buffer_b(buffer_a.size());
+    while (file_a && file_b) {
+        file_a.read(buffer_a.data(), buffer_a.size());
+        file_b.read(buffer_b.data(), buffer_b.size());
+
+        if (file_a.gcount() != file_b.gcount() ||
+            !std::equal(buffer_a.begin(), buffer_a.begin() + file_a.gcount(), buffer_b.begin())) {
+            return false;
+        }
+    }
+
+    // both have to end at the same time
+    return file_a.eof() && file_b.eof();
+};
+
+// compares every duplicate in a group with the first one byte by byte and untracks the ones that
+// differ, dropping groups that are left with a single entry. Returns the amount of untracked entries
+uintmax_t Broom::verify_duplicates(std::map<std::string, std::vector<entry::Entry>>& grouped_duplicates) {
+    uintmax_t untracked = 0;
+
+    for (auto record = grouped_duplicates.begin(); record != grouped_duplicates.end();) {
+        std::vector<entry::Entry>& group = record->second;
+        const std::filesystem::path original_file_path = group[0].path;
+
+        group.erase(std::remove_if(group.begin() + 1, group.end(), [&untracked, &original_file_path](entry::Entry& entry) -> bool {
+            if (!same_contents(original_file_path, entry.path)) {
+                untracked++;
+                return true;
+            }
+            return false;
+        }), group.end());
+
+        if (group.size() < 2) {
+            untracked += group.size();
+            record = grouped_duplicates.erase(record);
+        } else {
+            record++;
+        }
+    }
+
+    return untracked;
+};
+
 // REMOVES every duplicate file in a group except the first one and creates symlinks pointing to the
 // first remaining real file
 void Broom::remove_duplicates_make_symlinks(const std::map<std::string, std::vector<entry::Entry>> grouped_duplicates) {
@@ -26,9 +26,23 @@ along with broom.  If not, see <https://www.gnu.org/licenses/>.
 #include <string>
 
 #include "entry.hpp"
+#include "checkpoint.hpp"
 
 namespace broom {
 
+// Settings of a scan that are not kept in its checkpoint state
+struct Options {
+    unsigned int threads = 1; // amount of threads to hash a single big file and to remove empty directories with
+    bool verifying = false; // whether duplicates are compared byte by byte before acting on them
+    std::filesystem::path index_file = "broom.index"; // where signatures are exported when indexing
+};
+
+// What a finished scan has found
+struct Results {
+    std::map<std::string, std::vector<entry::Entry>> grouped_duplicates; // groups of duplicates, keyed by their hash
+    std::vector<std::filesystem::path> empty_directories; // empty directories that were found but not removed
+};
+
 // A class to find and manage duplicate, empty files
 class Broom {
 public:
@@ -39,6 +53,34 @@ public:
     // error in case path does not exist. Returns collected entries
     std::vector<entry::Entry> track(const std::filesystem::path path);
 
+    // creates a fresh scan state for given path. Throws an invalid_argument
+    // error in case path does not exist
+    checkpoint::State new_scan(const std::filesystem::path path);
+
+    // walks directories left in state's frontier, tracking every regular file on the way.
+    // State is periodically saved via given checkpointer, so the walk can be continued later
+    void track(checkpoint::State& state, checkpoint::Checkpointer& checkpointer);
+
+    // runs every stage that is left according to the command the state was started with and finishes
+    // the scan (see finish). State is periodically saved via given checkpointer, so the scan can be continued later
+    Results run(checkpoint::State& state, checkpoint::Checkpointer& checkpointer, const Options& options);
+
+    // completes the stage the state is at and moves it on to the next one, saving it via given checkpointer.
+    // Returns false if every stage is already done
+    bool run_stage(checkpoint::State& state, checkpoint::Checkpointer& checkpointer, const unsigned int threads);
+
+    // acts on the state that has gone through every stage: exports an index when indexing, otherwise groups duplicates
+    // and, when sweeping, REMOVES empty directories and REPLACES duplicates with symlinks. Removes the checkpoint
+    Results finish(checkpoint::State& state, checkpoint::Checkpointer& checkpointer, const Options& options);
+
+    // reads content pieces of state's entries, starting from the first unprocessed one. Entries that could not
+    // be read are untracked. State is periodically saved via given checkpointer, so reading can be continued later
+    void get_pieces(checkpoint::State& state, checkpoint::Checkpointer& checkpointer);
+
+    // hashes whole contents of state's entries, starting from the first unprocessed one, each file with given amount of
+    // threads. Entries that could not be read are untracked. State is periodically saved via given checkpointer
+    void get_hashes(checkpoint::State& state, checkpoint::Checkpointer& checkpointer, const unsigned int threads);
+
     // untracks entries with unique file sizes. Returns amount of files
     // that are no longer being tracked
     uintmax_t untrack_unique_sizes(std::vector<entry::Entry>& tracked_entries);
@@ -46,6 +88,10 @@ public:
     // untracks entries with the same content-pieces. Returns amount of
     // files that are no longer being tracked.
     uintmax_t untrack_unique_contents(std::vector<entry::Entry>& tracked_entries);
+
+    // untracks entries with unique whole contents hashes. Returns amount of
+    // files that are no longer being tracked.
+    uintmax_t untrack_unique_hashes(std::vector<entry::Entry>& tracked_entries);
     
     // Untracks specified group in tracked entries. Returns an amount of entries untracked 
     uintmax_t untrack_group(std::vector<entry::Entry>& tracked_entries, entry::Group group);
@@ -57,19 +103,43 @@ public:
     // REMOVES grouped empty files and untracks them after deletion. Returns the amount of removed empty files
     uintmax_t remove_empty_files(std::vector<entry::Entry>& tracked_entries);
 
+    // makes directories stop counting empty files among their children, as those are going to be removed. Has to
+    // be called while empty files are still among tracked entries
+    void discount_empty_files(std::vector<entry::Directory>& directories, const std::vector<entry::Entry>& tracked_entries);
+
+    // finds directories that are empty or contain nothing but such directories, judging by what was inside
+    // of them during the walk. Given root itself is never considered. Returns paths of found directories, the deepest ones first
+    std::vector<std::filesystem::path> find_empty_directories(const std::vector<entry::Directory>& directories, const std::filesystem::path root);
+
+    // REMOVES found empty directories (see find_empty_directories) bottom-up, so parents are removed after their children.
+    // Directories of the same depth are removed by given amount of threads at once. Returns the amount of removed directories
+    uintmax_t remove_empty_directories(const std::vector<std::filesystem::path>& empty_directories, const unsigned int threads);
+
     // marks every entry without any group as a duplicate
     void mark_as_duplicates(std::vector<entry::Entry>& tracked_entries);
 
-    // searches for entries with the same pieces in tracked entries and groups them together as a duplicate group, where the key is the
-    // string of pieces. REMOVES EVERYTHING FROM GIVEN TRACKED ENTRIES
+    // searches for entries with the same contents hash in tracked entries and groups them together as a duplicate group, where the key is the
+    // hex-encoded hash. REMOVES EVERYTHING FROM GIVEN TRACKED ENTRIES
     std::map<std::string, std::vector<entry::Entry>> group_duplicates(std::vector<entry::Entry>& tracked_entries);
 
+    // compares every duplicate in a group with the first one byte by byte and untracks the ones that
+    // differ, dropping groups that are left with a single entry. Returns the amount of untracked entries
+    uintmax_t verify_duplicates(std::map<std::string, std::vector<entry::Entry>>& grouped_duplicates);
+
     // REMOVES every duplicate file in a group except the first one and creates symlinks pointing to the
     // first remaining real file
     void remove_duplicates_make_symlinks(const std::map<std::string, std::vector<entry::Entry>> grouped_duplicates);
 
-    // creates a list of duplicate, empty files and puts it into a file
-    void create_scan_results_list(const std::map<std::string, std::vector<entry::Entry>> grouped_duplicates, const std::filesystem::path dir = ".", const std::string filename = "scan_results.txt");
+    // creates a list of duplicate, empty files and empty directories and puts it into a file
+    void create_scan_results_list(const std::map<std::string, std::vector<entry::Entry>> grouped_duplicates, const std::vector<std::filesystem::path> empty_directories, const std::filesystem::path dir = ".", const std::string filename = "scan_results.txt");
+
+    // exports signatures (size, pieces, hash, path) of hashed tracked entries into a sorted index file
+    // that can later be merged with indexes from other machines
+    void create_signature_index(const std::vector<entry::Entry>& tracked_entries, const std::filesystem::path file);
+
+    // merges signature indexes, possibly made on different machines, and puts groups of files with the same contents
+    // that are found in more than one index into a file. Returns amount of found groups
+    uintmax_t merge_signature_indexes(const std::vector<std::filesystem::path> indexes, const std::filesystem::path dir = ".", const std::string filename = "merge_results.txt");
 };
 
 }
@@ -0,0 +1,216 @@
+/*
+Copyright (C) 2021  Kasyanov Nikolay Alexeevich (Unbewohnte (me@unbewohnte.xyz))
+
+This file is part of broom.
+
+broom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+broom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with broom.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <cstring>
+
+#include "entry.hpp"
+#include "checkpoint.hpp"
+
+namespace checkpoint {
+
+// checkpoint file layout (native byte order, it is not meant to travel between machines):
+// MAGIC | version (u8) | stage (u8) | command (u8) | ignore empty (u8) | ignore empty directories (u8) | root | processed (u64) |
+// frontier amount (u64) | frontier paths.. | directories amount (u64) | directories.. | entries amount (u64) | entries..
+// where every string is its length (u64) followed by its bytes, every directory is path | children (u64) and
+// every entry is path | filesize (u64) | group (u8) | pieces | hash (u64)
+const char MAGIC[] = "BROOMCP";
+const uint8_t VERSION = 6;
+
+static void write_u64(std::ofstream& out, const uint64_t value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+};
+
+static void write_u8(std::ofstream& out, const uint8_t value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+};
+
+static void write_string(std::ofstream& out, const std::string& str) {
+    write_u64(out, str.size());
+    out.write(str.data(), str.size());
+};
+
+static uint64_t read_u64(std::ifstream& in) {
+    uint64_t value = 0;
+    in.read(reinterpret_cast<char*>(&value), sizeof(value));
+    if (!in) {
+        throw std::runtime_error("Checkpoint file is truncated");
+    }
+    return value;
+};
+
+static uint8_t read_u8(std::ifstream& in) {
+    uint8_t value = 0;
+    in.read(reinterpret_cast<char*>(&value), sizeof(value));
+    if (!in) {
+        throw std::runtime_error("Checkpoint file is truncated");
+    }
+    return value;
+};
+
+static std::string read_string(std::ifstream& in) {
+    uint64_t length = read_u64(in);
+    std::string str(length, '\0');
+    in.read(str.data(), length);
+    if (!in) {
+        throw std::runtime_error("Checkpoint file is truncated");
+    }
+    return str;
+};
+
+
+Checkpointer::Checkpointer(const std::filesystem::path file, const std::chrono::seconds interval)
+    : file(file), interval(interval), last_save(std::chrono::steady_clock::now()) {};
+
+Checkpointer::~Checkpointer() {};
+
+// returns true if checkpoints are being saved at all
+bool Checkpointer::enabled() const {
+    return !file.empty();
+};
+
+// returns true if checkpointing is enabled and more than an interval has passed since the last save
+bool Checkpointer::due() const {
+    if (!enabled()) {
+        return false;
+    }
+
+    return std::chrono::steady_clock::now() - last_save >= interval;
+};
+
+// saves state right away. The file is replaced atomically, so an interruption
+// in the middle of saving does not destroy the previous checkpoint
+void Checkpointer::save(const State& state) {
+    if (!enabled()) {
+        return;
+    }
+
+    std::filesystem::path temporary_file = file;
+    temporary_file += ".tmp";
+
+    std::ofstream out(temporary_file, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        throw std::runtime_error("Could not create checkpoint file \"" + temporary_file.string() + "\"");
+    }
+
+    out.write(MAGIC, sizeof(MAGIC) - 1);
+    write_u8(out, VERSION);
+    write_u8(out, state.stage);
+    write_u8(out, state.command);
+    write_u8(out, state.ignore_empty);
+    write_u8(out, state.ignore_empty_directories);
+    write_string(out, state.root.string());
+    write_u64(out, state.processed);
+
+    write_u64(out, state.frontier.size());
+    for (const std::filesystem::path& directory : state.frontier) {
+        write_string(out, directory.string());
+    }
+
+    write_u64(out, state.directories.size());
+    for (const entry::Directory& directory : state.directories) {
+        write_string(out, directory.path.string());
+        write_u64(out, directory.children);
+    }
+
+    write_u64(out, state.entries.size());
+    for (const entry::Entry& entry : state.entries) {
+        write_string(out, entry.path.string());
+        write_u64(out, entry.filesize);
+        write_u8(out, entry.group);
+        write_string(out, entry.pieces);
+        write_u64(out, entry.hash);
+    }
+
+    out.close();
+    if (!out) {
+        throw std::runtime_error("Could not write checkpoint file \"" + temporary_file.string() + "\"");
+    }
+
+    std::filesystem::rename(temporary_file, file);
+    last_save = std::chrono::steady_clock::now();
+};
+
+// removes checkpoint file from the disk (ie: when the scan is finished)
+void Checkpointer::remove() const {
+    if (!enabled()) {
+        return;
+    }
+
+    std::filesystem::remove(file);
+};
+
+// loads previously saved state. Throws a runtime_error if the file is missing
+// or is not a valid checkpoint
+State Checkpointer::load(const std::filesystem::path file) {
+    std::ifstream in(file, std::ios::binary);
+    if (!in.is_open()) {
+        throw std::runtime_error("Could not open checkpoint file \"" + file.string() + "\"");
+    }
+
+    char magic[sizeof(MAGIC) - 1];
+    in.read(magic, sizeof(magic));
+    if (!in || std::memcmp(magic, MAGIC, sizeof(magic)) != 0) {
+        throw std::runtime_error("\"" + file.string() + "\" is not a checkpoint file");
+    }
+
+    if (read_u8(in) != VERSION) {
+        throw std::runtime_error("\"" + file.string() + "\" was made by an incompatible version of broom");
+    }
+
+    State state;
+    state.stage = static_cast<Stage>(read_u8(in));
+    state.command = static_cast<Command>(read_u8(in));
+    state.ignore_empty = read_u8(in) != 0;
+    state.ignore_empty_directories = read_u8(in) != 0;
+    state.root = read_string(in);
+    state.processed = read_u64(in);
+
+    uint64_t frontier_amount = read_u64(in);
+    for (uint64_t i = 0; i < frontier_amount; i++) {
+        state.frontier.push_back(read_string(in));
+    }
+
+    uint64_t directories_amount = read_u64(in);
+    for (uint64_t i = 0; i < directories_amount; i++) {
+        entry::Directory directory;
+        directory.path = read_string(in);
+        directory.children = read_u64(in);
+        state.directories.push_back(directory);
+    }
+
+    uint64_t entries_amount = read_u64(in);
+    state.entries.reserve(entries_amount);
+    for (uint64_t i = 0; i < entries_amount; i++) {
+        std::filesystem::path path = read_string(in);
+        uintmax_t filesize = read_u64(in);
+
+        entry::Entry entry(path, filesize);
+        entry.group = static_cast<entry::Group>(read_u8(in));
+        entry.pieces = read_string(in);
+        entry.hash = read_u64(in);
+        state.entries.push_back(entry);
+    }
+
+    return state;
+};
+
+}
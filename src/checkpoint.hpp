@@ -0,0 +1,93 @@
+/*
+Copyright (C) 2021  Kasyanov Nikolay Alexeevich (Unbewohnte (me@unbewohnte.xyz))
+
+This file is part of broom.
+
+broom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+broom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with broom.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef CHECKPOINT_HPP
+#define CHECKPOINT_HPP
+
+#include <cstdint>
+#include <chrono>
+#include <filesystem>
+#include <vector>
+
+#include "entry.hpp"
+
+namespace checkpoint {
+
+// pipeline stage that was in progress when the checkpoint was taken
+enum Stage : uint8_t {
+    TRACKING, // walking the filesystem
+    PIECES, // reading content pieces of tracked entries
+    HASHING, // hashing whole contents of tracked entries
+    FINISHED, // every stage is done, only acting on the results is left
+};
+
+// command the scan was started with. The pipeline differs between them, so an
+// interrupted scan has to be continued with the same one
+enum Command : uint8_t {
+    SCAN,
+    SWEEP,
+    INDEX,
+};
+
+// Everything needed to continue an interrupted scan
+struct State {
+    Stage stage = TRACKING;
+    Command command = SCAN;
+    bool ignore_empty = false; // whether empty files are kept when sweeping
+    bool ignore_empty_directories = false; // whether empty directories are kept when sweeping
+    std::filesystem::path root; // absolute path that is being scanned
+    std::vector<std::filesystem::path> frontier; // directories that are yet to be walked
+    std::vector<entry::Directory> directories; // directories that are already walked
+    std::vector<entry::Entry> entries; // tracked entries
+    uintmax_t processed = 0; // amount of leading entries that are done with the current stage
+};
+
+// Periodically saves pipeline state to a compact binary file
+class Checkpointer {
+public:
+    // a checkpointer with an empty path does nothing
+    Checkpointer(const std::filesystem::path file = "", const std::chrono::seconds interval = std::chrono::seconds(60));
+    ~Checkpointer();
+
+    // returns true if checkpoints are being saved at all
+    bool enabled() const;
+
+    // returns true if checkpointing is enabled and more than an interval has passed since the last save
+    bool due() const;
+
+    // saves state right away. The file is replaced atomically, so an interruption
+    // in the middle of saving does not destroy the previous checkpoint
+    void save(const State& state);
+
+    // removes checkpoint file from the disk (ie: when the scan is finished)
+    void remove() const;
+
+    // loads previously saved state. Throws a runtime_error if the file is missing
+    // or is not a valid checkpoint
+    static State load(const std::filesystem::path file);
+
+private:
+    std::filesystem::path file;
+    std::chrono::seconds interval;
+    std::chrono::steady_clock::time_point last_save;
+};
+
+}
+
+#endif
@@ -18,6 +18,7 @@ along with broom.  If not, see <https://www.gnu.org/licenses/>.
 */
 
 #include "entry.hpp"
+#include "hash.hpp"
 
 #include <iostream>
 #include <cerrno>
@@ -35,20 +36,29 @@ Entry::Entry(const std::filesystem::path entry_path) {
     filesize = std::filesystem::file_size(path);
 };
 
+// restores an already known entry without touching the disk
+Entry::Entry(const std::filesystem::path entry_path, const uintmax_t entry_filesize) {
+    path = entry_path;
+    filesize = entry_filesize;
+};
+
 Entry::~Entry() {};
 
 // reads 3 pieces from the beginning, middle and the end of a file, converts them into
 // a convenient hex-encoded string. If a file has a size of less than PIECE_SIZE * PIECES_AMOUNT ->
 // constructs pieces from the whole file contents. If a file has no contents at all -> its pieces will be set to ""
 void Entry::get_pieces() {
-    std::fstream entry_file;
-    entry_file.open(path);
+    // read-only; a read-write stream can not open files we are only allowed to read
+    std::ifstream entry_file;
+    entry_file.open(path, std::ios::binary);
 
     if (!entry_file.is_open()) {
         throw std::ifstream::failure("Could not open \"" + path.string() + "\"");
     }
 
     char pieces_buffer[PIECE_SIZE * PIECES_AMOUNT];
+    // amount of meaningful bytes in pieces_buffer
+    uintmax_t pieces_length = PIECE_SIZE * PIECES_AMOUNT;
     if (filesize == 0) {
         // EMPTY file !
         pieces = "";
@@ -57,6 +67,7 @@ void Entry::get_pieces() {
         // can`t take whole 3 pieces !
         // read the whole file then
         entry_file.read(pieces_buffer, filesize);
+        pieces_length = filesize;
     } else {
         // read chunk from the beginning
         char begin_buf[PIECE_SIZE];
@@ -76,24 +87,36 @@ void Entry::get_pieces() {
         };
 
         // jump to the last CHUNK_SIZE bytes of the file and read the as well
-        entry_file.seekg(PIECE_SIZE, std::ios::end);
+        entry_file.seekg(-PIECE_SIZE, std::ios::end);
         char end_buf[PIECE_SIZE];
         entry_file.read(end_buf, PIECE_SIZE);
         for (uint8_t i = PIECE_SIZE * 2; i < PIECE_SIZE * 3; i++) {
             pieces_buffer[i] = end_buf[i - PIECE_SIZE * 2];
         };
     };
+
+    if (!entry_file) {
+        // the file changed since it was tracked. Do not let garbage in the buffer pass for its contents
+        throw std::ifstream::failure("Could not read \"" + path.string() + "\"");
+    }
     entry_file.close();
 
-    // make a convenient hex string out of pure bytes
+    // make a convenient hex string out of pure bytes. Every byte takes exactly 2 digits,
+    // otherwise different contents could end up as the same string
     std::stringstream pieces_hex;
-    for (uint8_t i = 0; i < PIECE_SIZE * 3; i++) {
-        pieces_hex << std::hex << static_cast<unsigned>(pieces_buffer[i]);
+    for (uintmax_t i = 0; i < pieces_length; i++) {
+        pieces_hex << std::hex << std::setw(2) << std::setfill('0') << static_cast<unsigned>(static_cast<unsigned char>(pieces_buffer[i]));
     };
 
     pieces = pieces_hex.str();
 };
 
+// hashes the whole file contents (see hash::hash_file), splitting the work between
+// given amount of threads
+void Entry::get_hash(const unsigned int threads) {
+    hash = hash::hash_file(path, filesize, threads);
+};
+
 // Remove entry from the disk
 void Entry::remove() const {
     std::filesystem::remove(path);
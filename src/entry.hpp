@@ -44,9 +44,12 @@ public:
     std::filesystem::path path; // set via constructor
     uintmax_t filesize; // set via constructor
     std::string pieces; // 3 hex-represented pieces of file; set only via a method call to not stress the disk
-    Group group; // set externally
+    uint64_t hash = 0; // hash of the whole file contents; set only via a method call to not stress the disk
+    Group group = DUPLICATE; // set externally
 
     Entry(const std::filesystem::path entry_path);
+    // restores an already known entry without touching the disk
+    Entry(const std::filesystem::path entry_path, const uintmax_t entry_filesize);
     ~Entry();
 
     // reads 3 pieces from the beginning, middle and the end of a file, converts them into
@@ -54,10 +57,20 @@ public:
     // constructs pieces from the whole file contents. If a file has no contents at all -> its pieces will be set to ""
     void get_pieces();
 
+    // hashes the whole file contents (see hash::hash_file), splitting the work between
+    // given amount of threads
+    void get_hash(const unsigned int threads = 1);
+
     // REMOVE entry from the disk
     void remove() const;
 };
 
+// A directory met during the walk
+struct Directory {
+    std::filesystem::path path;
+    uintmax_t children; // amount of things that were inside of it when it was walked
+};
+
 }
 
 
@@ -0,0 +1,326 @@
+/*
+Copyright (C) 2021  Kasyanov Nikolay Alexeevich (Unbewohnte (me@unbewohnte.xyz))
+
+This file is part of broom.
+
+broom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+broom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with broom.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <future>
+#include <functional>
+#include <vector>
+#include <algorithm>
+
+#include "hash.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#define BROOM_POSIX_IO
+#include <fcntl.h>
+#include <unistd.h>
+#include <setjmp.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
+namespace hash {
+
+const uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+const uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+const uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+const uint64_t PRIME4 = 0x85EBCA77C2B2AE63ULL;
+const uint64_t PRIME5 = 0x27D4EB2F165667C5ULL;
+
+static inline uint64_t rotl(const uint64_t value, const unsigned int amount) {
+    return (value << amount) | (value >> (64 - amount));
+};
+
+// reads are in native byte order, so hashes are only comparable between little-endian machines
+static inline uint64_t read_u64(const unsigned char* data) {
+    uint64_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+};
+
+static inline uint32_t read_u32(const unsigned char* data) {
+    uint32_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+};
+
+static inline uint64_t xxh_round(uint64_t accumulator, const uint64_t input) {
+    accumulator += input * PRIME2;
+    accumulator = rotl(accumulator, 31);
+    accumulator *= PRIME1;
+    return accumulator;
+};
+
+static inline uint64_t merge_round(uint64_t accumulator, const uint64_t value) {
+    accumulator ^= xxh_round(0, value);
+    accumulator = accumulator * PRIME1 + PRIME4;
+    return accumulator;
+};
+
+// 64-bit xxHash of given data
+uint64_t xxh64(const void* data, const size_t length, const uint64_t seed) {
+    const unsigned char* position = static_cast<const unsigned char*>(data);
+    const unsigned char* end = position + length;
+    uint64_t hash;
+
+    if (length >= 32) {
+        uint64_t v1 = seed + PRIME1 + PRIME2;
+        uint64_t v2 = seed + PRIME2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME1;
+
+        const unsigned char* limit = end - 32;
+        do {
+            v1 = xxh_round(v1, read_u64(position));
+            v2 = xxh_round(v2, read_u64(position + 8));
+            v3 = xxh_round(v3, read_u64(position + 16));
+            v4 = xxh_round(v4, read_u64(position + 24));
+            position += 32;
+        } while (position <= limit);
+
+        hash = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+        hash = merge_round(hash, v1);
+        hash = merge_round(hash, v2);
+        hash = merge_round(hash, v3);
+        hash = merge_round(hash, v4);
+    } else {
+        hash = seed + PRIME5;
+    }
+
+    hash += length;
+
+    while (position + 8 <= end) {
+        hash ^= xxh_round(0, read_u64(position));
+        hash = rotl(hash, 27) * PRIME1 + PRIME4;
+        position += 8;
+    }
+
+    if (position + 4 <= end) {
+        hash ^= static_cast<uint64_t>(read_u32(position)) * PRIME1;
+        hash = rotl(hash, 23) * PRIME2 + PRIME3;
+        position += 4;
+    }
+
+    while (position < end) {
+        hash ^= (*position) * PRIME5;
+        hash = rotl(hash, 11) * PRIME1;
+        position++;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+
+    return hash;
+};
+
+// hashes chunks worker, worker + workers, worker + workers * 2... of the file, reading them
+// into a buffer. Used when the file could not be mapped into memory
+static void hash_chunks_buffered(const std::filesystem::path path, const uintmax_t filesize, std::vector<uint64_t>& chunk_hashes, const unsigned int worker, const unsigned int workers) {
+    std::vector<char> buffer(std::min(filesize, CHUNK_SIZE));
+
+#ifdef BROOM_POSIX_IO
+    int file = open(path.c_str(), O_RDONLY);
+    if (file == -1) {
+        throw std::ifstream::failure("Could not open \"" + path.string() + "\"");
+    }
+    posix_fadvise(file, 0, 0, POSIX_FADV_SEQUENTIAL);
+#else
+    std::ifstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        throw std::ifstream::failure("Could not open \"" + path.string() + "\"");
+    }
+#endif
+
+    for (uintmax_t chunk = worker; chunk < chunk_hashes.size(); chunk += workers) {
+        uintmax_t offset = chunk * CHUNK_SIZE;
+        uintmax_t chunk_size = std::min(CHUNK_SIZE, filesize - offset);
+
+#ifdef BROOM_POSIX_IO
+        uintmax_t read_total = 0;
+        while (read_total < chunk_size) {
+            ssize_t read_now = pread(file, buffer.data() + read_total, chunk_size - read_total, offset + read_total);
+            if (read_now <= 0) {
+                close(file);
+                throw std::ifstream::failure("Could not read \"" + path.string() + "\"");
+            }
+            read_total += read_now;
+        }
+#else
+        file.seekg(offset, std::ios::beg);
+        file.read(buffer.data(), chunk_size);
+        if (!file) {
+            throw std::ifstream::failure("Could not read \"" + path.string() + "\"");
+        }
+#endif
+
+        chunk_hashes[chunk] = xxh64(buffer.data(), chunk_size, chunk);
+    }
+
+#ifdef BROOM_POSIX_IO
+    close(file);
+#endif
+};
+
+#ifdef BROOM_POSIX_IO
+// where a thread that is reading a mapped file goes if the file gets truncated under it. Touching mapped
+// pages past the new end of the file raises a SIGBUS, which would otherwise kill the whole process.
+// It is volatile, as nothing but the signal handler reads it and the stores would be optimized away
+static thread_local sigjmp_buf* volatile mapped_read_guard = nullptr;
+
+static void on_sigbus(const int signal) {
+    if (mapped_read_guard == nullptr) {
+        // not a mapped read of ours; let the faulting instruction crash the process as usual
+        struct sigaction action = {};
+        action.sa_handler = SIG_DFL;
+        sigaction(signal, &action, nullptr);
+        return;
+    }
+
+    siglongjmp(*mapped_read_guard, 1);
+};
+
+// installs the SIGBUS handler once per process
+static void guard_mapped_reads() {
+    static const bool installed = []() -> bool {
+        struct sigaction action = {};
+        action.sa_handler = on_sigbus;
+        sigemptyset(&action.sa_mask);
+        return sigaction(SIGBUS, &action, nullptr) == 0;
+    }();
+    (void) installed;
+};
+
+// hashes chunks worker, worker + workers, worker + workers * 2... of a file that is mapped into memory.
+// Throws an ifstream::failure if the file gets truncated in the meantime
+static void hash_chunks_mapped(const std::filesystem::path path, const unsigned char* contents, const uintmax_t filesize, std::vector<uint64_t>& chunk_hashes, const unsigned int worker, const unsigned int workers) {
+    // nothing with a destructor may live between here and the reads, as the jump back skips it
+    sigjmp_buf guard;
+    if (sigsetjmp(guard, 1) != 0) {
+        mapped_read_guard = nullptr;
+        throw std::ifstream::failure("\"" + path.string() + "\" was truncated while being hashed");
+    }
+    mapped_read_guard = &guard;
+
+    for (uintmax_t chunk = worker; chunk < chunk_hashes.size(); chunk += workers) {
+        uintmax_t offset = chunk * CHUNK_SIZE;
+        chunk_hashes[chunk] = xxh64(contents + offset, std::min(CHUNK_SIZE, filesize - offset), chunk);
+    }
+
+    mapped_read_guard = nullptr;
+};
+#endif
+
+// hashes the whole file as a two-level tree: every CHUNK_SIZE chunk is hashed on its own (spread between
+// given amount of threads), then chunk hashes are hashed together. The result does not depend on the amount of threads.
+// Throws an ifstream::failure in case the file could not be read
+uint64_t hash_file(const std::filesystem::path path, const uintmax_t filesize, const unsigned int threads) {
+    std::vector<uint64_t> chunk_hashes((filesize + CHUNK_SIZE - 1) / CHUNK_SIZE);
+    unsigned int workers = std::max(1u, (unsigned int) std::min<uintmax_t>(threads, chunk_hashes.size()));
+
+    const unsigned char* contents = nullptr;
+#ifdef BROOM_POSIX_IO
+    // map the whole file, so chunks are hashed right from the page cache without copying
+    int file = open(path.c_str(), O_RDONLY);
+    if (file == -1) {
+        throw std::ifstream::failure("Could not open \"" + path.string() + "\"");
+    }
+
+    // the file could have changed since it was tracked, there is no point in hashing it then. It still can
+    // shrink while it is being hashed (ie: a live VM image), mapped reads are guarded against that
+    struct stat file_info;
+    if (fstat(file, &file_info) == -1 || (uintmax_t) file_info.st_size != filesize) {
+        close(file);
+        throw std::ifstream::failure("\"" + path.string() + "\" has changed since it was tracked");
+    }
+
+    void* mapping = MAP_FAILED;
+    if (filesize > 0) {
+        mapping = mmap(nullptr, filesize, PROT_READ, MAP_PRIVATE, file, 0);
+    }
+    close(file);
+
+    if (mapping != MAP_FAILED) {
+        madvise(mapping, filesize, MADV_SEQUENTIAL);
+        contents = static_cast<const unsigned char*>(mapping);
+        guard_mapped_reads();
+    }
+#endif
+
+    std::vector<std::future<void>> jobs;
+    for (unsigned int worker = 1; worker < workers; worker++) {
+#ifdef BROOM_POSIX_IO
+        if (contents != nullptr) {
+            jobs.push_back(std::async(std::launch::async, hash_chunks_mapped, path, contents, filesize, std::ref(chunk_hashes), worker, workers));
+            continue;
+        }
+#endif
+        jobs.push_back(std::async(std::launch::async, hash_chunks_buffered, path, filesize, std::ref(chunk_hashes), worker, workers));
+    }
+
+    // the calling thread is a worker as well
+    std::exception_ptr error;
+    try {
+#ifdef BROOM_POSIX_IO
+        if (contents != nullptr) {
+            hash_chunks_mapped(path, contents, filesize, chunk_hashes, 0, workers);
+        } else {
+            hash_chunks_buffered(path, filesize, chunk_hashes, 0, workers);
+        }
+#else
+        hash_chunks_buffered(path, filesize, chunk_hashes, 0, workers);
+#endif
+    } catch(...) {
+        error = std::current_exception();
+    }
+
+    for (std::future<void>& job : jobs) {
+        try {
+            job.get();
+        } catch(...) {
+            error = std::current_exception();
+        }
+    }
+
+#ifdef BROOM_POSIX_IO
+    if (contents != nullptr) {
+        munmap(mapping, filesize);
+    }
+#endif
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+
+    return xxh64(chunk_hashes.data(), chunk_hashes.size() * sizeof(uint64_t), filesize);
+};
+
+// returns a fixed-width hex representation of a hash
+std::string to_hex(const uint64_t hash) {
+    std::stringstream hex;
+    hex << std::hex << std::setw(16) << std::setfill('0') << hash;
+    return hex.str();
+};
+
+}
@@ -0,0 +1,47 @@
+/*
+Copyright (C) 2021  Kasyanov Nikolay Alexeevich (Unbewohnte (me@unbewohnte.xyz))
+
+This file is part of broom.
+
+broom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+broom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with broom.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef HASH_HPP
+#define HASH_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <filesystem>
+#include <string>
+
+namespace hash {
+
+// files are split into chunks of this size which are hashed independently, so
+// a single huge file can be hashed by several threads at once
+const uintmax_t CHUNK_SIZE = 8 * 1024 * 1024;
+
+// 64-bit xxHash of given data
+uint64_t xxh64(const void* data, const size_t length, const uint64_t seed);
+
+// hashes the whole file as a two-level tree: every CHUNK_SIZE chunk is hashed on its own (spread between
+// given amount of threads), then chunk hashes are hashed together. The result does not depend on the amount of threads.
+// Throws an ifstream::failure in case the file could not be read
+uint64_t hash_file(const std::filesystem::path path, const uintmax_t filesize, const unsigned int threads);
+
+// returns a fixed-width hex representation of a hash
+std::string to_hex(const uint64_t hash);
+
+}
+
+#endif
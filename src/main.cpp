@@ -23,13 +23,19 @@ along with broom.  If not, see <https://www.gnu.org/licenses/>.
 #include <vector>
 #include <future>
 #include <algorithm>
+#include <chrono>
+#include <thread>
 
 #include "entry.hpp"
 #include "broom.hpp"
+#include "checkpoint.hpp"
 
 // Broom version number
 #define VERSION "v0.3.1"
 
+// names of checkpoint::Command values as they are given on the command line
+const char* COMMAND_NAMES[] = {"scan", "sweep", "index"};
+
 void print_help() {
     std::cout
     << "broom [FLAGS..] [COMMAND] [DIRECTORY]\n\n"
@@ -37,11 +43,20 @@ void print_help() {
     << "-v  | --version -> print version information and exit\n"
     << "-h  | --help -> print this message and exit\n"
     << "-ie | --ignore-empty -> do not remove empty files when sweeping\n"
-    << "-od | --output-directory -> path to the directory to save results file in when scanning\n\n"
+    << "-ied | --ignore-empty-directories -> do not remove empty directories when sweeping\n"
+    << "-od | --output-directory -> path to the directory to save results file in when scanning\n"
+    << "-cp | --checkpoint -> path to the file to periodically save scan progress in\n"
+    << "-ci | --checkpoint-interval -> amount of seconds between checkpoints [DEFAULT: 60]\n"
+    << "-r  | --resume -> continue an interrupted scan from the checkpoint file\n"
+    << "-t  | --threads -> amount of threads to hash a single big file and to remove empty directories with [DEFAULT: amount of CPU cores]\n"
+    << "-o  | --out -> path to the index file to create when indexing [DEFAULT: broom.index]\n"
+    << "-vr | --verify -> compare duplicates byte by byte before saving or acting on them\n\n"
 
     << "[COMMANDS]\n"
-    << "sweep -> scan for duplicate files, REMOVE empty files and REPLACE other duplicates with symlinks\n"
-    << "scan -> scan and save results in a file without removing anything [DEFAULT]\n\n"
+    << "sweep -> scan for duplicate files, REMOVE empty files and directories and REPLACE other duplicates with symlinks\n"
+    << "scan -> scan and save results in a file without removing anything [DEFAULT]\n"
+    << "index -> export signatures of every file into an index file to compare with other machines later\n"
+    << "merge-index -> merge index files given instead of the directory and save duplicates found between them in a file\n\n"
 
     << "[DIRECTORY]\n"
     << "path to the directory to be scanned\n\n";
@@ -72,7 +87,18 @@ int main(int argc, char* argv[]) {
     std::filesystem::path results_file_dir_path = ".";
     std::filesystem::path tracked_path;
     bool sweeping = false;
+    bool indexing = false;
+    bool merging_indexes = false;
+    std::filesystem::path index_file_path = "broom.index";
+    std::vector<std::filesystem::path> merged_index_paths;
     bool ignore_empty = false;
+    bool ignore_empty_directories = false;
+    std::filesystem::path checkpoint_file_path;
+    unsigned long checkpoint_interval = 60;
+    bool resuming = false;
+    bool command_given = false;
+    bool verifying = false;
+    unsigned int threads = std::max(1u, std::thread::hardware_concurrency());
 
     if (argc < 2) {
         print_help();
@@ -95,14 +121,62 @@ int main(int argc, char* argv[]) {
             i++;
             results_file_dir_path = std::filesystem::path(argv[i]);
         }
+        else if (strcmp(argv[i], "-cp") == 0 || strcmp(argv[i], "--checkpoint") == 0) {
+            i++;
+            checkpoint_file_path = std::filesystem::path(argv[i]);
+        }
+        else if (strcmp(argv[i], "-ci") == 0 || strcmp(argv[i], "--checkpoint-interval") == 0) {
+            i++;
+            try {
+                checkpoint_interval = std::stoul(argv[i]);
+            } catch(...) {
+                std::cerr << "[ERROR] Invalid checkpoint interval \"" << argv[i] << "\"\n";
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-t") == 0 || strcmp(argv[i], "--threads") == 0) {
+            i++;
+            try {
+                threads = std::max(1ul, std::stoul(argv[i]));
+            } catch(...) {
+                std::cerr << "[ERROR] Invalid amount of threads \"" << argv[i] << "\"\n";
+                return 1;
+            }
+        }
+        else if (strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "--out") == 0) {
+            i++;
+            index_file_path = std::filesystem::path(argv[i]);
+        }
+        else if (strcmp(argv[i], "-vr") == 0 || strcmp(argv[i], "--verify") == 0) {
+            verifying = true;
+        }
+        else if (strcmp(argv[i], "-r") == 0 || strcmp(argv[i], "--resume") == 0) {
+            resuming = true;
+        }
         else if (strcmp(argv[i], "-ie") == 0 || strcmp(argv[i], "--ignore-empty") == 0) {
             ignore_empty = true;
         }
+        else if (strcmp(argv[i], "-ied") == 0 || strcmp(argv[i], "--ignore-empty-directories") == 0) {
+            ignore_empty_directories = true;
+        }
         else if (strcmp(argv[i], "sweep") == 0) {
             sweeping = true;
+            command_given = true;
         }
         else if (strcmp(argv[i], "scan") == 0) {
             sweeping = false;
+            command_given = true;
+        }
+        else if (strcmp(argv[i], "index") == 0) {
+            indexing = true;
+            command_given = true;
+        }
+        else if (strcmp(argv[i], "merge-index") == 0) {
+            merging_indexes = true;
+        }
+        else if (merging_indexes) {
+            // add index to merge
+            merged_index_paths.push_back(std::filesystem::path(argv[i]));
         }
         else {
             // add path
@@ -110,8 +184,23 @@ int main(int argc, char* argv[]) {
         };
     };
 
+    if (resuming && checkpoint_file_path.empty()) {
+        std::cerr << "[ERROR] Nothing to resume from: no checkpoint file was specified\n";
+        return 1;
+    };
+
+    if (merging_indexes && merged_index_paths.size() < 2) {
+        std::cerr << "[ERROR] Need at least 2 index files to merge\n";
+        return 1;
+    };
+
+    if (resuming && !tracked_path.empty()) {
+        std::cerr << "[ERROR] Do not specify a path when resuming: the checkpoint already knows what is being scanned\n";
+        return 1;
+    };
+
     // no path was specified at all
-    if (tracked_path.empty()) {
+    if (tracked_path.empty() && !resuming && !merging_indexes) {
         print_help();
         return 1;
     };
@@ -128,66 +217,77 @@ int main(int argc, char* argv[]) {
         << "   /####/  \n"
         << "  //////   \n"
         << " ///////   \n\n";
-        if (sweeping) {
-            std::cout << "[Sweeping]\n\n";
-        } else {
-            std::cout << "[Scanning]\n\n";
+        checkpoint::Command command = checkpoint::SCAN;
+        if (indexing) {
+            command = checkpoint::INDEX;
+        } else if (sweeping) {
+            command = checkpoint::SWEEP;
         }
 
-        // track files in a given directory
-        std::vector<entry::Entry> tracked_entries = broom.track(tracked_path);
-        std::cout << "[INFO] Tracking " << tracked_entries.size() << " files\n";
+        checkpoint::State state;
+        if (resuming) {
+            state = checkpoint::Checkpointer::load(checkpoint_file_path);
+
+            // carry on with the command the scan was started with
+            if ((command_given && state.command != command) || (ignore_empty && !state.ignore_empty) ||
+                (ignore_empty_directories && !state.ignore_empty_directories)) {
+                std::cerr << "[ERROR] The checkpoint was made by \"" << COMMAND_NAMES[state.command]
+                << (state.ignore_empty ? " -ie" : "") << (state.ignore_empty_directories ? " -ied" : "")
+                << "\", resume without a command or with the same one\n";
+                return 1;
+            }
+            sweeping = state.command == checkpoint::SWEEP;
+            indexing = state.command == checkpoint::INDEX;
+            ignore_empty = state.ignore_empty;
+            ignore_empty_directories = state.ignore_empty_directories;
+            tracked_path = state.root;
+        } else if (!merging_indexes) {
+            state = broom.new_scan(tracked_path);
+            state.command = command;
+            state.ignore_empty = ignore_empty;
+            state.ignore_empty_directories = ignore_empty_directories;
+        }
 
-        // find empty files
-        uintmax_t empty_files = broom.find_empty_files(tracked_entries);
-        std::cout << "[INFO] Found " << empty_files << " empty files\n";
+        if (merging_indexes) {
+            std::cout << "[Merging indexes]\n\n";
 
-        // if sweeping - remove empty files right away
-        if (sweeping && !ignore_empty) {
-            uintmax_t removed = broom.remove_empty_files(tracked_entries);
-            std::cout << "[INFO] Removed " << removed << " empty files\n";
+            uintmax_t groups = broom.merge_signature_indexes(merged_index_paths, results_file_dir_path);
+            std::cout << "[INFO] Found " << groups << " groups of duplicates between indexes\n";
+            std::cout << "[INFO] Created merge results file\n";
+            return 0;
+        } else if (indexing) {
+            std::cout << "[Indexing]\n\n";
+            // nothing gets removed while indexing
+            sweeping = false;
+        } else if (sweeping) {
+            std::cout << "[Sweeping]\n\n";
         } else {
-            // just untrack them, do not remove
-            uintmax_t untracked_empty = broom.untrack_group(tracked_entries, entry::Group::EMPTY);
-            std::cout << "[INFO] Skipped " << untracked_empty << " empty files\n";
+            std::cout << "[Scanning]\n\n";
         }
 
-        // untrack unique sizes
-        uintmax_t untracked = broom.untrack_unique_sizes(tracked_entries);
-        std::cout << "[INFO] Untracked " << untracked << " files with a unique size\n";
-
-        // get content pieces for each entry
-        tracked_entries.erase(std::remove_if(tracked_entries.begin(), tracked_entries.end(), [](entry::Entry& entry) -> bool {
-            // ignore possible "permission denied"s
-            try {
-                entry.get_pieces();
-                return false;
-            } catch(...) {
-                return true;
-            }
-        }), tracked_entries.end());
-
-
-        // untrack unique contents
-        untracked = broom.untrack_unique_contents(tracked_entries);
-        std::cout << "[INFO] Untracked " << untracked << " files with unique contents\n";
+        checkpoint::Checkpointer checkpointer(checkpoint_file_path, std::chrono::seconds(checkpoint_interval));
+        if (resuming) {
+            std::cout << "[INFO] Resuming scan of " << tracked_path << " with " << state.entries.size() << " tracked files\n";
+        }
 
-        // mark entries as duplicates
-        broom.mark_as_duplicates(tracked_entries);
+        broom::Options options;
+        options.threads = threads;
+        options.verifying = verifying;
+        options.index_file = index_file_path;
+        broom::Results results = broom.run(state, checkpointer, options);
 
-        std::cout << "[INFO] " << tracked_entries.size() << " files left being tracked\n";
+        if (indexing) {
+            return 0;
+        }
 
-        if (tracked_entries.size() == 0) {
+        if (results.grouped_duplicates.empty() && results.empty_directories.empty()) {
             // No duplicates at all !
             std::cout << "[INFO] Nothing I can help with ! Congratulations !\n";
             return 0;
         }
 
-        // make duplicate groups from all this mess that tracked_entries right now are
-        auto grouped_duplicates = broom.group_duplicates(tracked_entries);
-
         double could_be_freed = 0;
-        for (auto& record : grouped_duplicates) {
+        for (auto& record : results.grouped_duplicates) {
             could_be_freed += record.second[0].filesize * (record.second.size() - 1);
         }
 
@@ -196,13 +296,10 @@ int main(int argc, char* argv[]) {
             // in the group will be deleted but one
             std::cout <<"[INFO] " << could_be_freed / 1024 / 1024 << " MB could be freed\n";
 
-            broom.create_scan_results_list(grouped_duplicates, results_file_dir_path);
+            broom.create_scan_results_list(results.grouped_duplicates, results.empty_directories, results_file_dir_path);
             std::cout << "[INFO] Created scan results file\n";
 
         } else {
-            // remove duplicates and create symlinks
-            std::cout << "[INFO] Removing duplicates and creating symlinks...\n";
-            broom.remove_duplicates_make_symlinks(grouped_duplicates);
             std::cout <<"[INFO] Freed approximately " << could_be_freed / 1024 / 1024 << " MB (May be incorrect)\n";
         }
 
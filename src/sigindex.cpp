@@ -0,0 +1,215 @@
+/*
+Copyright (C) 2021  Kasyanov Nikolay Alexeevich (Unbewohnte (me@unbewohnte.xyz))
+
+This file is part of broom.
+
+broom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+broom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with broom.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <queue>
+#include <stdexcept>
+#include <tuple>
+
+#include "sigindex.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#endif
+
+namespace sigindex {
+
+// index file layout (native byte order; like the hashes themselves, indexes are only comparable between little-endian machines):
+// MAGIC | version (u8) | host length (u32) | host | records amount (u64) | records..
+// where every record is size (u64) | fingerprint (u64) | hash (u64) | path length (u32) | path
+const char MAGIC[] = "BROOMIDX";
+const uint8_t VERSION = 3;
+
+// size of a read buffer for every opened index
+const size_t READ_BUFFER_SIZE = 1024 * 1024;
+
+static void write_u64(std::ofstream& out, const uint64_t value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+};
+
+static void write_u32(std::ofstream& out, const uint32_t value) {
+    out.write(reinterpret_cast<const char*>(&value), sizeof(value));
+};
+
+static void write_string(std::ofstream& out, const std::string& str) {
+    write_u32(out, str.size());
+    out.write(str.data(), str.size());
+};
+
+// returns true if both records describe the same contents
+bool Record::same_contents(const Record& other) const {
+    // cheap fields first, the whole contents hash only decides between files with the same pieces
+    return size == other.size && fingerprint == other.fingerprint && hash == other.hash;
+};
+
+// records are ordered by size, then fingerprint, then hash, then path, so the same contents end up next to each other
+bool operator<(const Record& a, const Record& b) {
+    return std::tie(a.size, a.fingerprint, a.hash, a.path) < std::tie(b.size, b.fingerprint, b.hash, b.path);
+};
+
+// returns the name of this machine or an empty string if it is unknown
+std::string hostname() {
+#if defined(__unix__) || defined(__APPLE__)
+    char name[256] = {0};
+    if (gethostname(name, sizeof(name) - 1) == 0) {
+        return std::string(name);
+    }
+#endif
+    return "";
+};
+
+// sorts records and writes them into an index file. Throws a runtime_error in case the file could not be written
+void write(const std::filesystem::path file, std::vector<Record>& records, const std::string host) {
+    std::sort(records.begin(), records.end());
+
+    std::ofstream out(file, std::ios::binary | std::ios::trunc);
+    if (!out.is_open()) {
+        throw std::runtime_error("Could not create index file \"" + file.string() + "\"");
+    }
+
+    out.write(MAGIC, sizeof(MAGIC) - 1);
+    out.put(VERSION);
+    write_string(out, host);
+    write_u64(out, records.size());
+
+    for (const Record& record : records) {
+        write_u64(out, record.size);
+        write_u64(out, record.fingerprint);
+        write_u64(out, record.hash);
+        write_string(out, record.path);
+    }
+
+    out.close();
+    if (!out) {
+        throw std::runtime_error("Could not write index file \"" + file.string() + "\"");
+    }
+};
+
+
+// opens an index file and reads its header. Throws a runtime_error if the file is missing
+// or is not a valid index
+Reader::Reader(const std::filesystem::path file) : records_amount(0), file(file), buffer(READ_BUFFER_SIZE), records_read(0) {
+    // records are read one by one, a bigger buffer saves a lot of syscalls
+    in.rdbuf()->pubsetbuf(buffer.data(), buffer.size());
+    in.open(file, std::ios::binary);
+    if (!in.is_open()) {
+        throw std::runtime_error("Could not open index file \"" + file.string() + "\"");
+    }
+
+    char magic[sizeof(MAGIC) - 1];
+    in.read(magic, sizeof(magic));
+    if (!in || std::memcmp(magic, MAGIC, sizeof(magic)) != 0) {
+        throw std::runtime_error("\"" + file.string() + "\" is not an index file");
+    }
+
+    if (in.get() != VERSION) {
+        throw std::runtime_error("\"" + file.string() + "\" was made by an incompatible version of broom");
+    }
+
+    uint32_t host_length = 0;
+    in.read(reinterpret_cast<char*>(&host_length), sizeof(host_length));
+    host.resize(host_length);
+    in.read(host.data(), host_length);
+    in.read(reinterpret_cast<char*>(&records_amount), sizeof(records_amount));
+    if (!in) {
+        throw std::runtime_error("Index file \"" + file.string() + "\" is truncated");
+    }
+};
+
+Reader::~Reader() {};
+
+// reads the next record. Returns false if there are none left.
+// Throws a runtime_error if the file ends unexpectedly
+bool Reader::next(Record& record) {
+    if (records_read == records_amount) {
+        return false;
+    }
+
+    uint32_t path_length = 0;
+    in.read(reinterpret_cast<char*>(&record.size), sizeof(record.size));
+    in.read(reinterpret_cast<char*>(&record.fingerprint), sizeof(record.fingerprint));
+    in.read(reinterpret_cast<char*>(&record.hash), sizeof(record.hash));
+    in.read(reinterpret_cast<char*>(&path_length), sizeof(path_length));
+    record.path.resize(path_length);
+    in.read(record.path.data(), path_length);
+    if (!in) {
+        throw std::runtime_error("Index file \"" + file.string() + "\" is truncated");
+    }
+
+    records_read++;
+    return true;
+};
+
+
+// k-way merges sorted indexes opened by given readers, calling on_group for every group of the same contents that
+// is spread across more than one index. The group is a list of (reader number, record) pairs.
+// Only one group at a time is kept in memory. Returns amount of found groups
+uintmax_t merge(std::vector<std::unique_ptr<Reader>>& readers, const std::function<void(const std::vector<std::pair<size_t, Record>>&)> on_group) {
+    // the smallest record of every index is on top
+    auto greater = [](const std::pair<size_t, Record>& a, const std::pair<size_t, Record>& b) -> bool {
+        return b.second < a.second;
+    };
+    std::priority_queue<std::pair<size_t, Record>, std::vector<std::pair<size_t, Record>>, decltype(greater)> heads(greater);
+
+    for (size_t i = 0; i < readers.size(); i++) {
+        Record record;
+        if (readers[i]->next(record)) {
+            heads.push({i, record});
+        }
+    }
+
+    uintmax_t groups = 0;
+    std::vector<std::pair<size_t, Record>> group;
+
+    // passes the group on if it spans several indexes
+    auto flush = [&groups, &group, &on_group]() {
+        for (const auto& member : group) {
+            if (member.first != group[0].first) {
+                on_group(group);
+                groups++;
+                break;
+            }
+        }
+        group.clear();
+    };
+
+    while (!heads.empty()) {
+        std::pair<size_t, Record> head = heads.top();
+        heads.pop();
+
+        if (!group.empty() && !group[0].second.same_contents(head.second)) {
+            flush();
+        }
+
+        // refill from the same index
+        Record record;
+        if (readers[head.first]->next(record)) {
+            heads.push({head.first, record});
+        }
+
+        group.push_back(std::move(head));
+    }
+    flush();
+
+    return groups;
+};
+
+}
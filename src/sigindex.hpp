@@ -0,0 +1,84 @@
+/*
+Copyright (C) 2021  Kasyanov Nikolay Alexeevich (Unbewohnte (me@unbewohnte.xyz))
+
+This file is part of broom.
+
+broom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+broom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with broom.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SIGINDEX_HPP
+#define SIGINDEX_HPP
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Signature indexes: sorted files of file signatures that can be exported on different
+// machines and merged together later to find duplicates between them
+namespace sigindex {
+
+// Signature of a single file
+struct Record {
+    uint64_t size;
+    uint64_t fingerprint; // hash of the sampled content pieces
+    uint64_t hash; // hash of the whole contents
+    std::string path;
+
+    // returns true if both records describe the same contents
+    bool same_contents(const Record& other) const;
+};
+
+// records are ordered by size, then fingerprint, then hash, then path, so the same contents end up next to each other
+bool operator<(const Record& a, const Record& b);
+
+// returns the name of this machine or an empty string if it is unknown
+std::string hostname();
+
+// sorts records and writes them into an index file. Throws a runtime_error in case the file could not be written
+void write(const std::filesystem::path file, std::vector<Record>& records, const std::string host);
+
+// Sequentially reads records from an index file
+class Reader {
+public:
+    // opens an index file and reads its header. Throws a runtime_error if the file is missing
+    // or is not a valid index
+    Reader(const std::filesystem::path file);
+    ~Reader();
+
+    std::string host; // machine the index was made on
+    uint64_t records_amount; // amount of records in the index
+
+    // reads the next record. Returns false if there are none left.
+    // Throws a runtime_error if the file ends unexpectedly
+    bool next(Record& record);
+
+private:
+    std::filesystem::path file;
+    std::vector<char> buffer; // must outlive the stream that uses it
+    std::ifstream in;
+    uint64_t records_read;
+};
+
+// k-way merges sorted indexes opened by given readers, calling on_group for every group of the same contents that
+// is spread across more than one index. The group is a list of (reader number, record) pairs.
+// Only one group at a time is kept in memory. Returns amount of found groups
+uintmax_t merge(std::vector<std::unique_ptr<Reader>>& readers, const std::function<void(const std::vector<std::pair<size_t, Record>>&)> on_group);
+
+}
+
+#endif
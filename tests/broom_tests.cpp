@@ -0,0 +1,641 @@
+/*
+Copyright (C) 2021  Kasyanov Nikolay Alexeevich (Unbewohnte (me@unbewohnte.xyz))
+
+This file is part of broom.
+
+broom is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 3 of the License, or
+(at your option) any later version.
+
+broom is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with broom.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+// Correctness checks of the deduplication pipeline: random trees are run through every pipeline
+// configuration and the results are compared with a brute-force byte-by-byte oracle
+
+#include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <random>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <functional>
+#include <memory>
+#include <future>
+#include <thread>
+
+#include "../src/entry.hpp"
+#include "../src/broom.hpp"
+#include "../src/checkpoint.hpp"
+#include "../src/hash.hpp"
+#include "../src/sigindex.hpp"
+
+// amount of failed checks
+static unsigned int failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            failures++; \
+            std::cerr << "[FAIL] " << __FILE__ << ":" << __LINE__ << ": " << #condition << "\n"; \
+        } \
+    } while (0)
+
+// groups of paths with the same contents
+typedef std::set<std::set<std::string>> Groups;
+
+static void write_file(const std::filesystem::path path, const std::string& contents) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(contents.data(), contents.size());
+};
+
+static std::string read_file(const std::filesystem::path path) {
+    std::ifstream file(path, std::ios::binary);
+    return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+};
+
+static std::string random_contents(std::mt19937_64& random, const size_t size) {
+    std::string contents(size, '\0');
+    for (char& byte : contents) {
+        byte = static_cast<char>(random() & 0xFF);
+    }
+    return contents;
+};
+
+// creates a random tree of files in root: unique files, exact duplicates, near-duplicates that only differ
+// outside of sampled pieces or in the very last byte, read-only duplicates, empty files and empty directories
+static void make_random_tree(const std::filesystem::path root, const uint64_t seed) {
+    std::mt19937_64 random(seed);
+
+    std::vector<std::filesystem::path> directories = {root};
+    for (unsigned int i = 0; i < 12; i++) {
+        std::filesystem::path directory = directories[random() % directories.size()] / ("dir" + std::to_string(i));
+        std::filesystem::create_directories(directory);
+        directories.push_back(directory);
+    }
+    auto random_path = [&](const std::string name) -> std::filesystem::path {
+        return directories[random() % directories.size()] / name;
+    };
+
+    // sizes around interesting boundaries: inside a single piece, all pieces, a single chunk and several chunks
+    const std::vector<size_t> sizes = {
+        1, 2, 74, 75, 224, 225, 226, 1000, 4096, 100000,
+        hash::CHUNK_SIZE - 1, hash::CHUNK_SIZE + 1, hash::CHUNK_SIZE * 2 + 7,
+    };
+
+    for (size_t i = 0; i < sizes.size(); i++) {
+        const size_t size = sizes[i];
+        std::string original = random_contents(random, size);
+        write_file(random_path("original" + std::to_string(i)), original);
+
+        // exact duplicates
+        unsigned int copies = random() % 3;
+        for (unsigned int copy = 0; copy < copies; copy++) {
+            write_file(random_path("copy" + std::to_string(i) + "_" + std::to_string(copy)), original);
+        }
+
+        // differs in the very last byte
+        std::string last_byte_different = original;
+        last_byte_different.back() ^= 0x01;
+        write_file(random_path("last" + std::to_string(i)), last_byte_different);
+
+        if (size > 1000) {
+            // differs between sampled pieces, so only hashing can tell
+            std::string near_duplicate = original;
+            near_duplicate[size / 4] ^= 0x01;
+            write_file(random_path("near" + std::to_string(i)), near_duplicate);
+            write_file(random_path("near_copy" + std::to_string(i)), near_duplicate);
+        }
+
+        // a read-only duplicate
+        if (random() % 2 == 0) {
+            std::filesystem::path read_only = random_path("read_only" + std::to_string(i));
+            write_file(read_only, original);
+            std::filesystem::permissions(read_only, std::filesystem::perms::owner_read | std::filesystem::perms::group_read | std::filesystem::perms::others_read);
+        }
+    }
+
+    // contents that used to collide with the old variable-width hex encoding of pieces ("1" "23" vs "12" "3")
+    write_file(random_path("encoding_a"), std::string("\x01\x23", 2));
+    write_file(random_path("encoding_b"), std::string("\x12\x03", 2));
+
+    // empty files and directories
+    for (unsigned int i = 0; i < 4; i++) {
+        write_file(random_path("empty" + std::to_string(i)), "");
+    }
+    std::filesystem::create_directories(root / "empty_dir" / "nested");
+};
+
+// brute-force oracle: groups every non-empty regular file in root with the files of exactly the same contents
+static Groups oracle_groups(const std::filesystem::path root) {
+    std::map<std::string, std::set<std::string>> by_contents;
+    for (const auto& dir_entry : std::filesystem::recursive_directory_iterator(root)) {
+        if (!dir_entry.is_regular_file() || dir_entry.is_symlink() || dir_entry.file_size() == 0) {
+            continue;
+        }
+        by_contents[read_file(dir_entry.path())].insert(dir_entry.path().string());
+    }
+
+    Groups groups;
+    for (const auto& record : by_contents) {
+        if (record.second.size() > 1) {
+            groups.insert(record.second);
+        }
+    }
+    return groups;
+};
+
+// saves state into a checkpoint file and loads it back, as if the process was killed and resumed
+static checkpoint::State reload(checkpoint::Checkpointer& checkpointer, const checkpoint::State& state, const std::filesystem::path file) {
+    checkpointer.save(state);
+    return checkpoint::Checkpointer::load(file);
+};
+
+// converts duplicate groups found by broom into plain paths
+static Groups paths_of(const std::map<std::string, std::vector<entry::Entry>>& grouped_duplicates) {
+    Groups groups;
+    for (const auto& record : grouped_duplicates) {
+        std::set<std::string> group;
+        for (const entry::Entry& entry : record.second) {
+            group.insert(entry.path.string());
+        }
+        groups.insert(group);
+    }
+    return groups;
+};
+
+// runs the real pipeline on root with given command and options. With a checkpoint file the state is saved and
+// loaded back after every stage and in the middle of hashing, as if the process was killed and resumed each time.
+// tamper is called on the state right before the scan is finished
+static broom::Results run_pipeline(const std::filesystem::path root, const checkpoint::Command command, const broom::Options options,
+    const std::filesystem::path checkpoint_file, const std::function<void(checkpoint::State&)> tamper = nullptr) {
+    broom::Broom broom;
+    checkpoint::Checkpointer checkpointer(checkpoint_file, std::chrono::seconds(0));
+
+    checkpoint::State state = broom.new_scan(root);
+    state.command = command;
+
+    if (checkpoint_file.empty()) {
+        if (!tamper) {
+            return broom.run(state, checkpointer, options);
+        }
+        while (broom.run_stage(state, checkpointer, options.threads)) {}
+    } else {
+        while (true) {
+            if (state.stage == checkpoint::HASHING) {
+                // get interrupted halfway through hashing
+                for (; state.processed < state.entries.size() / 2; state.processed++) {
+                    state.entries[state.processed].get_hash(options.threads);
+                }
+                state = reload(checkpointer, state, checkpoint_file);
+            }
+
+            if (!broom.run_stage(state, checkpointer, options.threads)) {
+                break;
+            }
+            // get interrupted right after the stage was saved
+            state = checkpoint::Checkpointer::load(checkpoint_file);
+        }
+    }
+
+    if (tamper) {
+        tamper(state);
+    }
+    return broom.finish(state, checkpointer, options);
+};
+
+static void test_pipeline_matches_oracle(const std::filesystem::path workdir) {
+    for (uint64_t seed = 1; seed <= 3; seed++) {
+        std::filesystem::path root = workdir / ("tree" + std::to_string(seed));
+        make_random_tree(root, seed);
+        Groups expected = oracle_groups(root);
+
+        for (unsigned int threads : {1u, 4u}) {
+            for (bool checkpointing : {false, true}) {
+                std::filesystem::path checkpoint_file = checkpointing ? workdir / "checkpoint.bin" : "";
+                broom::Options options;
+                options.threads = threads;
+
+                auto start = std::chrono::steady_clock::now();
+                broom::Results results = run_pipeline(root, checkpoint::SCAN, options, checkpoint_file);
+                auto took = std::chrono::steady_clock::now() - start;
+
+                Groups got = paths_of(results.grouped_duplicates);
+                if (got != expected) {
+                    std::cerr << "[INFO] seed " << seed << ", " << threads << " threads, checkpoints " << checkpointing << "\n";
+                }
+                CHECK(got == expected);
+                // scanning reports empty directories, but never removes them
+                CHECK(!results.empty_directories.empty());
+                CHECK(std::filesystem::exists(root / "empty_dir" / "nested"));
+                CHECK(!std::filesystem::exists(checkpoint_file));
+                // a tree of a few dozen megabytes has no excuse to take long
+                CHECK(took < std::chrono::seconds(20));
+            }
+        }
+    }
+};
+
+static void test_sweep(const std::filesystem::path workdir) {
+    for (bool checkpointing : {false, true}) {
+        std::filesystem::path root = workdir / ("swept" + std::to_string(checkpointing));
+        make_random_tree(root, 4);
+        Groups expected = oracle_groups(root);
+
+        // remember what every path had to say
+        std::map<std::string, std::string> contents;
+        for (const std::set<std::string>& group : expected) {
+            for (const std::string& path : group) {
+                contents[path] = read_file(path);
+            }
+        }
+
+        broom::Options options;
+        options.threads = 4;
+        options.verifying = true;
+        broom::Results results = run_pipeline(root, checkpoint::SWEEP, options, checkpointing ? workdir / "checkpoint.bin" : "");
+        CHECK(paths_of(results.grouped_duplicates) == expected);
+
+        // every group is left with a single real file, the rest point to it and read the same
+        for (const std::set<std::string>& group : expected) {
+            unsigned int real_files = 0;
+            for (const std::string& path : group) {
+                if (!std::filesystem::is_symlink(path)) {
+                    real_files++;
+                }
+                CHECK(read_file(path) == contents[path]);
+            }
+            CHECK(real_files == 1);
+        }
+
+        // empty files and directories are gone
+        for (const auto& dir_entry : std::filesystem::recursive_directory_iterator(root)) {
+            CHECK(!dir_entry.is_directory() || !std::filesystem::is_empty(dir_entry.path()));
+            CHECK(!dir_entry.is_regular_file() || dir_entry.file_size() != 0);
+        }
+        CHECK(!std::filesystem::exists(root / "empty_dir"));
+        CHECK(results.empty_directories.empty());
+    }
+};
+
+static void test_verify(const std::filesystem::path workdir) {
+    std::filesystem::path root = workdir / "verified";
+    make_random_tree(root, 5);
+
+    // plant a hash collision: once everything is hashed, a duplicate that is not the first of its group
+    // gets different contents of the same size
+    auto plant_collision = [](checkpoint::State& state) {
+        for (size_t i = 0; i < state.entries.size(); i++) {
+            const entry::Entry& planted = state.entries[i];
+            if (planted.path.filename().string().rfind("read_only", 0) == 0) {
+                continue;
+            }
+            for (size_t j = 0; j < i; j++) {
+                if (state.entries[j].hash == planted.hash) {
+                    std::string contents = read_file(planted.path);
+                    contents[contents.size() / 2] ^= 0x01;
+                    write_file(planted.path, contents);
+                    return;
+                }
+            }
+        }
+    };
+
+    broom::Options options;
+    broom::Results trusting = run_pipeline(root, checkpoint::SCAN, options, "", plant_collision);
+    Groups expected = oracle_groups(root);
+    CHECK(paths_of(trusting.grouped_duplicates) != expected);
+
+    // the same tree gets the same collision planted once again
+    make_random_tree(root, 5);
+    options.verifying = true;
+    broom::Results verified = run_pipeline(root, checkpoint::SCAN, options, "", plant_collision);
+    CHECK(paths_of(verified.grouped_duplicates) == oracle_groups(root));
+
+    // a group of two different files goes away completely
+    write_file(workdir / "collision_a", "aaaa");
+    write_file(workdir / "collision_b", "bbbb");
+    std::map<std::string, std::vector<entry::Entry>> grouped_duplicates;
+    grouped_duplicates["0"].push_back(entry::Entry(workdir / "collision_a"));
+    grouped_duplicates["0"].push_back(entry::Entry(workdir / "collision_b"));
+    broom::Broom broom;
+    CHECK(broom.verify_duplicates(grouped_duplicates) == 2);
+    CHECK(grouped_duplicates.empty());
+};
+
+// reads every record of an index file
+static std::vector<sigindex::Record> read_index(const std::filesystem::path file) {
+    sigindex::Reader reader(file);
+    std::vector<sigindex::Record> records;
+    sigindex::Record record;
+    while (reader.next(record)) {
+        records.push_back(record);
+    }
+    return records;
+};
+
+static void test_signature_indexes(const std::filesystem::path workdir) {
+    // two volumes with the same files, one of them with a few more of its own
+    std::filesystem::path root = workdir / "indexed";
+    make_random_tree(root / "a", 6);
+    make_random_tree(root / "b", 6);
+    make_random_tree(root / "b" / "extra", 7);
+
+    std::vector<std::filesystem::path> indexes = {workdir / "a.index", workdir / "b.index"};
+    for (size_t i = 0; i < indexes.size(); i++) {
+        broom::Options options;
+        options.threads = 4;
+        options.index_file = indexes[i];
+        run_pipeline(root / (i == 0 ? "a" : "b"), checkpoint::INDEX, options, i == 0 ? workdir / "checkpoint.bin" : "");
+    }
+
+    // files with a unique size or unique pieces could still have duplicates on other machines, so every
+    // non-empty file is kept
+    std::set<std::string> non_empty_files;
+    for (const auto& dir_entry : std::filesystem::recursive_directory_iterator(root / "a")) {
+        if (dir_entry.is_regular_file() && dir_entry.file_size() != 0) {
+            non_empty_files.insert(dir_entry.path().string());
+        }
+    }
+    std::set<std::string> indexed_files;
+    for (const sigindex::Record& record : read_index(indexes[0])) {
+        indexed_files.insert(record.path);
+    }
+    CHECK(indexed_files == non_empty_files);
+    CHECK(std::filesystem::exists(root / "a" / "empty_dir" / "nested"));
+
+    // merging finds exactly the groups of the same contents that span both volumes
+    Groups expected;
+    for (const std::set<std::string>& group : oracle_groups(root)) {
+        bool in_a = false;
+        bool in_b = false;
+        for (const std::string& path : group) {
+            in_a = in_a || path.rfind((root / "a").string() + "/", 0) == 0;
+            in_b = in_b || path.rfind((root / "b").string() + "/", 0) == 0;
+        }
+        if (in_a && in_b) {
+            expected.insert(group);
+        }
+    }
+
+    std::vector<std::unique_ptr<sigindex::Reader>> readers;
+    for (const std::filesystem::path& index : indexes) {
+        readers.push_back(std::make_unique<sigindex::Reader>(index));
+    }
+    Groups merged;
+    uintmax_t amount = sigindex::merge(readers, [&merged](const std::vector<std::pair<size_t, sigindex::Record>>& group) {
+        std::set<std::string> paths;
+        for (const auto& member : group) {
+            paths.insert(member.second.path);
+        }
+        merged.insert(paths);
+    });
+    CHECK(!expected.empty());
+    CHECK(merged == expected);
+    CHECK(amount == expected.size());
+
+    broom::Broom broom;
+    CHECK(broom.merge_signature_indexes(indexes, workdir / "merged") == expected.size());
+    CHECK(read_file(workdir / "merged" / "merge_results.txt").find(" (a.index): ") != std::string::npos);
+
+    // a truncated index is refused instead of being merged partially
+    std::filesystem::copy_file(indexes[1], workdir / "truncated.index");
+    std::filesystem::resize_file(workdir / "truncated.index", std::filesystem::file_size(indexes[1]) / 2);
+    bool threw = false;
+    try {
+        read_index(workdir / "truncated.index");
+    } catch(const std::runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+
+    std::filesystem::resize_file(workdir / "truncated.index", 10);
+    threw = false;
+    try {
+        sigindex::Reader reader(workdir / "truncated.index");
+    } catch(const std::runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+};
+
+static void test_pieces(const std::filesystem::path workdir) {
+    std::mt19937_64 random(42);
+
+    // identical small files have identical pieces
+    std::string small = random_contents(random, 100);
+    write_file(workdir / "small_a", small);
+    write_file(workdir / "small_b", small);
+    entry::Entry small_a(workdir / "small_a");
+    entry::Entry small_b(workdir / "small_b");
+    small_a.get_pieces();
+    small_b.get_pieces();
+    CHECK(small_a.pieces == small_b.pieces);
+    CHECK(small_a.pieces.size() == small.size() * 2);
+
+    // the last piece is taken from the end of the file
+    std::string big = random_contents(random, 10000);
+    std::string big_last_different = big;
+    big_last_different.back() ^= 0x01;
+    write_file(workdir / "big_a", big);
+    write_file(workdir / "big_b", big);
+    write_file(workdir / "big_c", big_last_different);
+    entry::Entry big_a(workdir / "big_a");
+    entry::Entry big_b(workdir / "big_b");
+    entry::Entry big_c(workdir / "big_c");
+    big_a.get_pieces();
+    big_b.get_pieces();
+    big_c.get_pieces();
+    CHECK(big_a.pieces == big_b.pieces);
+    CHECK(big_a.pieces != big_c.pieces);
+
+    // every byte takes exactly 2 hex digits
+    write_file(workdir / "encoding_a", std::string("\x01\x23", 2));
+    write_file(workdir / "encoding_b", std::string("\x12\x03", 2));
+    entry::Entry encoding_a(workdir / "encoding_a");
+    entry::Entry encoding_b(workdir / "encoding_b");
+    encoding_a.get_pieces();
+    encoding_b.get_pieces();
+    CHECK(encoding_a.pieces == "0123");
+    CHECK(encoding_a.pieces != encoding_b.pieces);
+
+    // read-only files can be read
+    std::filesystem::permissions(workdir / "big_a", std::filesystem::perms::owner_read);
+    entry::Entry read_only(workdir / "big_a");
+    bool threw = false;
+    try {
+        read_only.get_pieces();
+    } catch(...) {
+        threw = true;
+    }
+    CHECK(!threw);
+    CHECK(read_only.pieces == big_b.pieces);
+};
+
+static void test_hashing(const std::filesystem::path workdir) {
+    // reference xxHash64 values
+    CHECK(hash::xxh64("", 0, 0) == 0xEF46DB3751D8E999ULL);
+    CHECK(hash::xxh64("abc", 3, 0) == 0x44BC2CF5AD770999ULL);
+
+    // the amount of threads does not change the hash
+    std::mt19937_64 random(7);
+    const uintmax_t size = hash::CHUNK_SIZE * 4 + 123;
+    write_file(workdir / "huge", random_contents(random, size));
+    uint64_t single = hash::hash_file(workdir / "huge", size, 1);
+    CHECK(hash::hash_file(workdir / "huge", size, 3) == single);
+    CHECK(hash::hash_file(workdir / "huge", size, 16) == single);
+
+    // hashing runs at least at a sane speed, the file is in the page cache by now
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < 4; i++) {
+        hash::hash_file(workdir / "huge", size, 4);
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    CHECK((size * 4.0) / (1024 * 1024) / seconds > 100.0);
+
+    // a file that shrinks while it is being hashed is refused instead of crashing the process. The timing is up
+    // to the scheduler, so truncation is attempted at different moments
+    const std::string contents = read_file(workdir / "huge");
+    unsigned int truncated_in_time = 0;
+    for (unsigned int attempt = 0; attempt < 20; attempt++) {
+        write_file(workdir / "huge", contents);
+        auto hashing = std::async(std::launch::async, [&workdir, size]() -> bool {
+            try {
+                hash::hash_file(workdir / "huge", size, 4);
+                return false;
+            } catch(const std::ifstream::failure&) {
+                return true;
+            }
+        });
+        std::this_thread::sleep_for(std::chrono::microseconds(attempt * 500));
+        std::filesystem::resize_file(workdir / "huge", 1000);
+        if (hashing.get()) {
+            truncated_in_time++;
+        }
+    }
+    CHECK(truncated_in_time > 0);
+
+    // a file that shrank since it was tracked is refused as well
+    bool threw = false;
+    try {
+        hash::hash_file(workdir / "huge", size, 4);
+    } catch(const std::ifstream::failure&) {
+        threw = true;
+    }
+    CHECK(threw);
+};
+
+static void test_checkpoint(const std::filesystem::path workdir) {
+    broom::Broom broom;
+    std::filesystem::path root = workdir / "walked";
+    std::filesystem::create_directories(root / "kept");
+    write_file(root / "kept" / "file", "contents");
+
+    // a directory from an old checkpoint that no longer exists does not stop the walk
+    checkpoint::State state = broom.new_scan(root);
+    state.frontier.push_back(root / "gone");
+    state.command = checkpoint::SWEEP;
+    state.ignore_empty = true;
+    state.ignore_empty_directories = true;
+    checkpoint::Checkpointer checkpointer;
+    bool threw = false;
+    try {
+        broom.track(state, checkpointer);
+    } catch(...) {
+        threw = true;
+    }
+    CHECK(!threw);
+    CHECK(state.entries.size() == 1);
+
+    // everything survives a round trip
+    std::filesystem::path checkpoint_file = workdir / "walked.checkpoint";
+    checkpoint::Checkpointer saver(checkpoint_file);
+    saver.save(state);
+    checkpoint::State loaded = checkpoint::Checkpointer::load(checkpoint_file);
+    CHECK(loaded.command == checkpoint::SWEEP);
+    CHECK(loaded.ignore_empty);
+    CHECK(loaded.ignore_empty_directories);
+    CHECK(loaded.root == state.root);
+    CHECK(loaded.entries.size() == state.entries.size());
+    CHECK(loaded.directories.size() == state.directories.size());
+    saver.remove();
+
+    // a scan started with a relative path keeps working on the same tree when resumed from elsewhere
+    std::filesystem::path working_directory = std::filesystem::current_path();
+    std::filesystem::current_path(workdir);
+    checkpoint::State relative = broom.new_scan("walked");
+    std::filesystem::current_path(working_directory);
+    saver.save(relative);
+    loaded = checkpoint::Checkpointer::load(checkpoint_file);
+    CHECK(loaded.root == root);
+    CHECK(loaded.frontier.size() == 1 && loaded.frontier[0].is_absolute());
+    broom.track(loaded, checkpointer);
+    CHECK(loaded.entries.size() == 1 && loaded.entries[0].path == root / "kept" / "file");
+    saver.remove();
+};
+
+static void test_empty_directories(const std::filesystem::path workdir) {
+    broom::Broom broom;
+    std::filesystem::path root = workdir / "pruned";
+    std::filesystem::create_directories(root / "e" / "f");
+    std::filesystem::create_directories(root / "k" / "l");
+    write_file(root / "e" / "f" / "empty", "");
+    write_file(root / "k" / "keep", "contents");
+
+    checkpoint::State state = broom.new_scan(root);
+    checkpoint::Checkpointer checkpointer;
+    broom.track(state, checkpointer);
+    broom.find_empty_files(state.entries);
+    broom.discount_empty_files(state.directories, state.entries);
+
+    // what scan reports is what sweep removes
+    std::vector<std::filesystem::path> empty_directories = broom.find_empty_directories(state.directories, state.root);
+    CHECK(empty_directories.size() == 3);
+
+    broom.remove_empty_files(state.entries);
+    CHECK(broom.remove_empty_directories(empty_directories, 4) == 3);
+    CHECK(!std::filesystem::exists(root / "e"));
+    CHECK(!std::filesystem::exists(root / "k" / "l"));
+    CHECK(std::filesystem::exists(root / "k" / "keep"));
+};
+
+int main() {
+    std::filesystem::path workdir = std::filesystem::temp_directory_path() / ("broom_tests_" + std::to_string(std::random_device()()));
+    std::filesystem::create_directories(workdir);
+    // scanned paths are canonical, so expected ones have to be as well
+    workdir = std::filesystem::canonical(workdir);
+
+    try {
+        test_pieces(workdir);
+        test_hashing(workdir);
+        test_checkpoint(workdir);
+        test_empty_directories(workdir);
+        test_pipeline_matches_oracle(workdir);
+        test_sweep(workdir);
+        test_verify(workdir);
+        test_signature_indexes(workdir);
+    } catch(const std::exception& e) {
+        failures++;
+        std::cerr << "[FAIL] unexpected exception: " << e.what() << "\n";
+    }
+
+    std::filesystem::remove_all(workdir);
+
+    if (failures != 0) {
+        std::cerr << failures << " checks failed\n";
+        return 1;
+    }
+
+    std::cout << "All checks passed\n";
+    return 0;
+};